@@ -1,4 +1,7 @@
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include "buildpart_common.h"
 
 static inline
@@ -64,5 +67,21 @@ struct svm_model* train_svm(const struct svm_problem* problem,
 
     } while (!check_model(model, param.coef_max));
 
+    /*
+     * The support vectors point into the training problem, which in turn
+     * points into the sampled points, so give the model its own copy of them
+     */
+    if (model && !model->free_sv) {
+        for (int i = 0; i < model->l; i++) {
+            size_t size = model->SV[i].dim * sizeof(double);
+            double* values = (double*)malloc(size);
+            if (!values)
+                throw std::bad_alloc();
+            memcpy(values, model->SV[i].values, size);
+            model->SV[i].values = values;
+        }
+        model->free_sv = 1;
+    }
+
     return model;
 }
@@ -6,6 +6,10 @@
 
 #ifdef __cplusplus
 
+/**
+ * Trains a model on `problem`. The model owns its support vectors, so the
+ * problem and the points it refers to may be released once it returns.
+ */
 struct svm_model* train_svm(const struct svm_problem* problem, struct svm_parameter& param);
 
 #endif
@@ -1,32 +1,40 @@
+#include <algorithm>
+#include <cstdint>
 #include <exception>
 #include <numeric>
+#include <vector>
 
 #include "debug.h"
+#include "thread_pool.h"
 #include "buildpart_kdsvm.h"
 
 
 struct KdSVM_Internal : Node_Internal {
     using Node_Internal::Node_Internal;
-    PSP_KdSVMTree transformed;
+    PSP_KdSVMTree transformed = nullptr;
     PSP_KdSVMTree_Data data;
-    svm_problem problem;
 
     ~KdSVM_Internal();
 };
 using KdSVM_InternalPtr = std::shared_ptr<KdSVM_Internal>;
 
+/**
+ * A separating plane yet to be trained: the regions of `indices` before `mid`
+ * go to the left subtree of `node`, the rest to the right.
+ */
+struct KdSVM_Split {
+    KdSVM_Internal* node;
+    std::vector<size_t> indices;
+    size_t mid;
+    size_t num_points;
+};
+
 KdSVM_Internal::~KdSVM_Internal()
 {
     delete transformed;
-    if (left != nullptr || right != nullptr) {
+    if ((left != nullptr || right != nullptr) && data.model != nullptr) {
         svm_destroy_param(&data.model->param);
         svm_free_and_destroy_model(&data.model);
-        delete[] problem.y;
-        for (int i = 0; i < problem.l; i++)
-        {
-            delete[] problem.x[i].values;
-        }
-        delete[] problem.x;
     }
 }
 
@@ -48,19 +56,8 @@ struct svm_model* build_svm(PSP_Result const& regions,
                             std::vector<size_t>::const_iterator begin,
                             std::vector<size_t>::const_iterator mid,
                             std::vector<size_t>::const_iterator end,
-                            svm_parameter const* parameters,
-                            svm_problem* problem)
+                            svm_parameter const* parameters)
 {
-    DEBUG_LOG("SVM: { ");
-    for (auto it = begin; it < mid; it++) {
-        DEBUG_LOG(regions.patterns[*it] << " ");
-    }
-    DEBUG_LOG("} vs. { ");
-    for (auto it = mid; it < end; it++) {
-        DEBUG_LOG(regions.patterns[*it] << " ");
-    }
-    DEBUG_LOG("}\n");
-
     size_t dim = nDim(regions);
 
     svm_parameter param = {};
@@ -81,44 +78,46 @@ struct svm_model* build_svm(PSP_Result const& regions,
     for (auto it = begin; it < end; it++) {
         num_points += regions.xs[*it].size();
     }
+    if (num_points == 0)
+        throw std::invalid_argument("no sampled points to train on");
 
-    problem->l = num_points;
-    problem->x = new struct svm_node[num_points];
-    problem->y = new double[num_points];
+    /* the nodes refer to the sampled points in place */
+    std::vector<svm_node> nodes;
+    std::vector<double> labels;
+    nodes.reserve(num_points);
+    labels.reserve(num_points);
 
-    int i = 0;
     for (auto it = begin; it < end; it++) {
-        for (auto & point : regions.xs[*it]) {
-            assert(i < num_points);
-
-            svm_node node;
-            node.dim = dim;
-            node.values = new double[dim];
-            Eigen::Map<Point>(node.values, dim) = point;
-
-            problem->x[i] = node;
-            problem->y[i] = it < mid ? 1 : -1;
-            i++;
+        Points const& points = regions.xs[*it];
+        for (size_t j = 0; j < points.size(); j++) {
+            nodes.push_back({ (int)dim, const_cast<double*>(points.data() + j * dim) });
+            labels.push_back(it < mid ? 1 : -1);
         }
     }
 
-    const char* error_msg = svm_check_parameter(problem, &param);
+    svm_problem problem = { num_points, labels.data(), nodes.data() };
+    const char* error_msg = svm_check_parameter(&problem, &param);
     if (error_msg)
         throw std::invalid_argument(error_msg);
 
-    return train_svm(problem, param);
+    return train_svm(&problem, param);
 }
 
+/**
+ * Builds the shape of the tree, adding the planes to train to `splits`. The
+ * regions are split by their means alone, so the planes are independent of
+ * each other and can be trained in any order.
+ */
 static inline
 KdSVM_InternalPtr build_kdsvm_internal(PSP_Result const& regions,
                                        std::vector<size_t>::iterator begin,
                                        std::vector<size_t>::iterator end,
-                                       svm_parameter const* param,
+                                       std::vector<KdSVM_Split>& splits,
                                        size_t dim_ = 0)
 {
     PSP_KdSVMTree_Data data;
     KdSVM_InternalPtr left, right;
-    svm_problem problem = {};
+    size_t split = SIZE_MAX;
 
     if (begin >= end) {
         return KdSVM_InternalPtr_Make();
@@ -154,20 +153,38 @@ KdSVM_InternalPtr build_kdsvm_internal(PSP_Result const& regions,
 
         // find median of points in the chosen dimension
         auto mid = begin + (end - begin) / 2;
-        std::nth_element(begin, mid, end, [regions, dim](size_t lhs, size_t rhs) {
+        std::nth_element(begin, mid, end, [&regions, dim](size_t lhs, size_t rhs) {
             return regions.xMean[lhs][dim] < regions.xMean[rhs][dim];
         });
 
-        // build the separating plane
-        data.model = build_svm(regions, begin, mid, end, param, &problem);
+        DEBUG_LOG("SVM: { ");
+        for (auto it = begin; it < mid; it++) {
+            DEBUG_LOG(regions.patterns[*it] << " ");
+        }
+        DEBUG_LOG("} vs. { ");
+        for (auto it = mid; it < end; it++) {
+            DEBUG_LOG(regions.patterns[*it] << " ");
+        }
+        DEBUG_LOG("}\n");
+
+        // the separating plane, trained on the regions in their current order
+        size_t num_points = 0;
+        for (auto it = begin; it < end; it++) {
+            num_points += regions.xs[*it].size();
+        }
+        data.model = nullptr;
+        split = splits.size();
+        splits.push_back({ nullptr, std::vector<size_t>(begin, end),
+                           (size_t)(mid - begin), num_points });
 
-        left = build_kdsvm_internal(regions, begin, mid, param, dim + 1);
-        right = build_kdsvm_internal(regions, mid, end, param, dim + 1);
+        left = build_kdsvm_internal(regions, begin, mid, splits, dim + 1);
+        right = build_kdsvm_internal(regions, mid, end, splits, dim + 1);
     }
 
     KdSVM_InternalPtr result = KdSVM_InternalPtr_Make(left, right);
     result->data = data;
-    result->problem = problem;
+    if (split < splits.size())
+        splits[split].node = result.get();
 
     return result;
 }
@@ -189,14 +206,38 @@ PSP_KdSVMTree transform_kdsvm(Node_InternalPtr const& kdsvm)
     return result;
 }
 
-PSP_KdSVMTree build_kdsvm(PSP_Result data,
+PSP_KdSVMTree build_kdsvm(PSP_Result const& data,
                           svm_parameter const* param,
+                          unsigned int num_threads,
                           PSP_Memory memory)
 {
     std::vector<size_t> indices(data.patterns.size());
     std::iota(std::begin(indices), std::end(indices), 0);
 
-    memory->kdsvm = build_kdsvm_internal(data, std::begin(indices), std::end(indices), param);
+    std::vector<KdSVM_Split> splits;
+    KdSVM_InternalPtr tree = build_kdsvm_internal(data, std::begin(indices), std::end(indices),
+                                                  splits);
+
+    /*
+     * Train the planes on `num_threads` threads, the largest first so that
+     * the threads finish together. Each training holds its own problem and
+     * kernel cache, so the number of threads also bounds the memory used.
+     */
+    std::vector<size_t> order(splits.size());
+    std::iota(std::begin(order), std::end(order), 0);
+    std::stable_sort(std::begin(order), std::end(order), [&splits](size_t lhs, size_t rhs) {
+        return splits[lhs].num_points > splits[rhs].num_points;
+    });
+
+    ThreadPool pool(num_threads > 1 ? num_threads : 1);
+    pool.parallel_for(order.size(), [&](size_t i) {
+        KdSVM_Split const& split = splits[order[i]];
+        auto begin = split.indices.cbegin();
+        split.node->data.model = build_svm(data, begin, begin + split.mid,
+                                           split.indices.cend(), param);
+    });
+
+    memory->kdsvm = tree;
 
     return transform_kdsvm(memory->kdsvm);
 }
@@ -27,7 +27,9 @@ typedef struct PSP_KdSVMTreeRec_ {
 }
 
 
-PSP_KdSVMTree build_kdsvm(PSP_Result data, svm_parameter const* param, PSP_Memory memory);
+/** Builds the tree, training its planes on `num_threads` threads */
+PSP_KdSVMTree build_kdsvm(PSP_Result const& data, svm_parameter const* param,
+                          unsigned int num_threads, PSP_Memory memory);
 #endif
 
 #endif
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <exception>
+#include <vector>
 
 #include "debug.h"
 #include "buildpart_mcsvm.h"
@@ -8,7 +10,6 @@ struct MCSVM_Internal : Node_Internal {
     using Node_Internal::Node_Internal;
     PSP_MCSVM transformed;
     svm_model* model;
-    svm_problem problem;
 
     ~MCSVM_Internal();
 };
@@ -19,17 +20,11 @@ MCSVM_Internal::~MCSVM_Internal()
     delete transformed;
     svm_destroy_param(&model->param);
     svm_free_and_destroy_model(&model);
-    delete[] problem.y;
-    for (int i = 0; i < problem.l; i++) {
-        delete[] problem.x[i].values;
-    }
-    delete[] problem.x;
 }
 
 static inline
 struct svm_model* build_svm(PSP_Result const& regions,
-                            svm_parameter const* parameters,
-                            svm_problem* problem)
+                            svm_parameter const* parameters)
 {
     size_t dim = nDim(regions);
 
@@ -51,44 +46,38 @@ struct svm_model* build_svm(PSP_Result const& regions,
     for (size_t i = 0; i < regions.patterns.size(); i++) {
         num_points += regions.xs[i].size();
     }
+    if (num_points == 0)
+        throw std::invalid_argument("no sampled points to train on");
 
-    problem->l = num_points;
-    problem->x = new struct svm_node[num_points];
-    problem->y = new double[num_points];
+    /* the nodes refer to the sampled points in place */
+    std::vector<svm_node> nodes;
+    std::vector<double> labels;
+    nodes.reserve(num_points);
+    labels.reserve(num_points);
 
-    int i = 0;
     for (size_t j = 0; j < regions.patterns.size(); j++) {
-        for (auto & point : regions.xs[j]) {
-            assert(i < num_points);
-
-            svm_node node;
-            node.dim = dim;
-            node.values = new double[dim];
-            Eigen::Map<Point>(node.values, dim) = point;
-
-            problem->x[i] = node;
-            problem->y[i] = regions.patterns[j];
-            i++;
+        Points const& points = regions.xs[j];
+        for (size_t k = 0; k < points.size(); k++) {
+            nodes.push_back({ (int)dim, const_cast<double*>(points.data() + k * dim) });
+            labels.push_back(regions.patterns[j]);
         }
     }
 
-    const char* error_msg = svm_check_parameter(problem, &param);
+    svm_problem problem = { num_points, labels.data(), nodes.data() };
+    const char* error_msg = svm_check_parameter(&problem, &param);
     if (error_msg)
         throw std::invalid_argument(error_msg);
 
-    return train_svm(problem, param);
+    return train_svm(&problem, param);
 }
 
 static inline
 MCSVM_InternalPtr build_mcsvm_internal(PSP_Result const& regions,
                                        svm_parameter const* param)
 {
-    svm_problem problem = {};
-
     MCSVM_InternalPtr result = std::make_shared<MCSVM_Internal>(MCSVM_InternalPtr(),
                                                                 MCSVM_InternalPtr());
-    result->model = build_svm(regions, param, &problem);
-    result->problem = problem;
+    result->model = build_svm(regions, param);
 
     return result;
 }
@@ -108,7 +97,7 @@ PSP_MCSVM transform_mcsvm(Node_InternalPtr const& mcsvm)
     return result;
 }
 
-PSP_MCSVM build_mcsvm(PSP_Result data,
+PSP_MCSVM build_mcsvm(PSP_Result const& data,
                       svm_parameter const* param,
                       PSP_Memory memory)
 {
@@ -22,7 +22,7 @@ typedef struct PSP_MCSVMRec_ {
 }
 
 
-PSP_MCSVM build_mcsvm(PSP_Result data, svm_parameter const* param, PSP_Memory memory);
+PSP_MCSVM build_mcsvm(PSP_Result const& data, svm_parameter const* param, PSP_Memory memory);
 #endif
 
 #endif
@@ -0,0 +1,85 @@
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+
+static uint64_t checksum(std::vector<char> const& bytes)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char c : bytes) {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+
+RecordWriter::RecordWriter(char const* path, long offset)
+{
+    if (offset > 0 && truncate(path, offset) != 0)
+        throw PSP::checkpoint_error("cannot truncate checkpoint file");
+
+    file = fopen(path, offset > 0 ? "ab" : "wb");
+    if (!file)
+        throw PSP::checkpoint_error("cannot open checkpoint file for writing");
+}
+
+RecordWriter::~RecordWriter()
+{
+    fclose(file);
+}
+
+void RecordWriter::commit(uint32_t type)
+{
+    uint64_t size = payload.size();
+    uint64_t sum = checksum(payload);
+
+    bool ok = fwrite(&type, sizeof(type), 1, file) == 1
+              && fwrite(&size, sizeof(size), 1, file) == 1
+              && fwrite(payload.data(), 1, size, file) == size
+              && fwrite(&sum, sizeof(sum), 1, file) == 1
+              && fflush(file) == 0;
+    payload.clear();
+
+    if (!ok)
+        throw PSP::checkpoint_error("cannot write checkpoint file");
+}
+
+
+RecordReader::RecordReader(char const* path)
+{
+    file = fopen(path, "rb");
+    if (!file)
+        throw PSP::checkpoint_error("cannot open checkpoint file for reading");
+
+    fseek(file, 0, SEEK_END);
+    file_size = ftell(file);
+}
+
+RecordReader::~RecordReader()
+{
+    fclose(file);
+}
+
+bool RecordReader::next(uint32_t & type)
+{
+    uint64_t size, sum;
+
+    if (fseek(file, offset, SEEK_SET) != 0
+        || fread(&type, sizeof(type), 1, file) != 1
+        || fread(&size, sizeof(size), 1, file) != 1)
+        return false;
+
+    if (size > (uint64_t)(file_size - ftell(file)))
+        return false;
+    payload.resize(size);
+
+    if (fread(payload.data(), 1, size, file) != size
+        || fread(&sum, sizeof(sum), 1, file) != 1
+        || sum != checksum(payload))
+        return false;
+
+    pos = 0;
+    offset = ftell(file);
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#ifdef __cplusplus
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "psp_mcmc.h"
+
+
+/*
+ * A checkpoint file is a sequence of records, each made of a type, the size of
+ * its payload, the payload and a checksum of the payload. Records are only
+ * ever appended, and a record cut short by a crash fails its checksum, so the
+ * file can always be read back up to its last complete record. Values are
+ * stored in the native byte order.
+ */
+
+enum CheckpointRecord : uint32_t {
+    CHECKPOINT_HEADER = 1,
+    CHECKPOINT_STATE = 2,
+    CHECKPOINT_RESULT = 3,
+};
+
+/** Appends records to a checkpoint file. */
+class RecordWriter {
+public:
+    /**
+     * Opens `path` for appending after its first `offset` bytes, dropping the
+     * rest of the file. An offset of 0 creates a new file.
+     */
+    RecordWriter(char const* path, long offset);
+    RecordWriter(RecordWriter const& other) = delete;
+    RecordWriter & operator=(RecordWriter const& other) = delete;
+    ~RecordWriter();
+
+    template <typename T>
+    void put(T const* values, size_t n)
+    {
+        char const* bytes = reinterpret_cast<char const*>(values);
+        payload.insert(payload.end(), bytes, bytes + n * sizeof(T));
+    }
+
+    template <typename T>
+    void put(T const& value) { put(&value, 1); }
+
+    /** Writes out everything put since the last commit as one record */
+    void commit(uint32_t type);
+
+private:
+    FILE* file;
+    std::vector<char> payload;
+};
+
+/** Reads back the complete records of a checkpoint file. */
+class RecordReader {
+public:
+    explicit RecordReader(char const* path);
+    RecordReader(RecordReader const& other) = delete;
+    RecordReader & operator=(RecordReader const& other) = delete;
+    ~RecordReader();
+
+    /**
+     * Loads the next record, returning false at the end of the file or at a
+     * record that was not completely written.
+     */
+    bool next(uint32_t & type);
+
+    /** The offset just past the last record loaded */
+    long end() const { return offset; }
+
+    template <typename T>
+    void get(T* values, size_t n)
+    {
+        if (pos + n * sizeof(T) > payload.size())
+            throw PSP::checkpoint_error("truncated record");
+        memcpy(values, payload.data() + pos, n * sizeof(T));
+        pos += n * sizeof(T);
+    }
+
+    template <typename T>
+    void get(T & value) { get(&value, 1); }
+
+    template <typename T>
+    T get() { T value; get(value); return value; }
+
+private:
+    FILE* file;
+    std::vector<char> payload;
+    size_t pos = 0;
+    long offset = 0;
+    long file_size;
+};
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,65 @@
+#include "eval_cache.h"
+
+
+size_t Point_Fixed_Hash::operator()(Point_Fixed const& x) const
+{
+    size_t h = 14695981039346656037ull;
+    for (Eigen::Index i = 0; i < x.size(); i++) {
+        h ^= std::hash<Fixed>()(x[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+size_t EvalCache::entry_bytes(Point_Fixed const& x)
+{
+    /* map node, hash bucket, eviction queue slot and coordinates */
+    return sizeof(std::pair<Point_Fixed const, Pattern>) + 4 * sizeof(void*)
+           + x.size() * sizeof(Fixed);
+}
+
+bool EvalCache::lookup(Point_Fixed const& x, Pattern & ptn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = entries.find(x);
+    if (it == entries.end()) {
+        num_misses++;
+        return false;
+    }
+
+    num_hits++;
+    ptn = it->second;
+    return true;
+}
+
+void EvalCache::insert(Point_Fixed const& x, Pattern ptn)
+{
+    size_t size = entry_bytes(x);
+    if (size > max_bytes)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    while (num_bytes + size > max_bytes && !order.empty()) {
+        Point_Fixed oldest = *order.front();
+        order.pop_front();
+        entries.erase(oldest);
+        num_bytes -= entry_bytes(oldest);
+    }
+
+    auto inserted = entries.emplace(x, ptn);
+    if (inserted.second) {
+        order.push_back(&inserted.first->first);
+        num_bytes += size;
+    }
+}
+
+void EvalCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    order.clear();
+    entries.clear();
+    num_bytes = 0;
+}
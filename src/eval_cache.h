@@ -0,0 +1,55 @@
+#ifndef EVAL_CACHE_H
+#define EVAL_CACHE_H
+
+#ifdef __cplusplus
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "pspart.h"
+
+
+using Point_Fixed = Eigen::VectorX<Fixed>;
+
+struct Point_Fixed_Hash {
+    size_t operator()(Point_Fixed const& x) const;
+};
+
+/**
+ * A bounded memo of model evaluations keyed on the exact fixed point
+ * coordinates passed to the sampler. Once the estimated memory use reaches the
+ * cap, the oldest entries are evicted first. Safe to use from several threads.
+ */
+class EvalCache {
+public:
+    explicit EvalCache(size_t max_bytes) : max_bytes(max_bytes) { };
+
+    /** Looks up a point, counting a hit or a miss. */
+    bool lookup(Point_Fixed const& x, Pattern & ptn);
+    void insert(Point_Fixed const& x, Pattern ptn);
+    /** Drops all entries, keeping the counts of hits and misses. */
+    void clear();
+
+    size_t hits() const { return num_hits; }
+    size_t misses() const { return num_misses; }
+    size_t size() const { return entries.size(); }
+    size_t bytes() const { return num_bytes; }
+
+private:
+    static size_t entry_bytes(Point_Fixed const& x);
+
+    size_t max_bytes;
+    size_t num_bytes = 0;
+    size_t num_hits = 0;
+    size_t num_misses = 0;
+
+    std::mutex mutex;
+    std::unordered_map<Point_Fixed, Pattern, Point_Fixed_Hash> entries;
+    std::deque<Point_Fixed const*> order;
+};
+
+#endif
+
+#endif
+
+/* EOF */
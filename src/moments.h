@@ -0,0 +1,90 @@
+#ifndef MOMENTS_H
+#define MOMENTS_H
+
+#ifdef __cplusplus
+#include <stddef.h>
+
+#include <Eigen/Core>
+#include "simd_kernels.h"
+
+
+/* a += x * y^T */
+template <int N>
+static inline
+void add_outer(Eigen::Matrix<double, N, N> & a,
+               Eigen::Matrix<double, N, 1> const& x,
+               Eigen::Matrix<double, N, 1> const& y)
+{
+    a.noalias() += x * y.transpose();
+}
+
+static inline
+void add_outer(Eigen::MatrixXd & a, Eigen::VectorXd const& x, Eigen::VectorXd const& y)
+{
+    add_outer(a.data(), x.data(), y.data(), x.size());
+}
+
+/**
+ * The running mean and covariance of a sequence of points, updated in one
+ * pass with Welford's algorithm. Two sets of moments can be merged in
+ * O(D^2) with the pairwise update of Chan, Golub and LeVeque (1979), so the
+ * moments of separate chains or searches combine without their points.
+ */
+template <int N = Eigen::Dynamic>
+struct Moments {
+    using Vec = Eigen::Matrix<double, N, 1>;
+    using Mat = Eigen::Matrix<double, N, N>;
+
+    Moments() = default;
+    explicit Moments(Eigen::Index dim)
+    : mean(Vec::Zero(dim)), m2(Mat::Zero(dim, dim)), delta(dim), residual(dim) { };
+
+    /** Recovers the moments of `count` points from their mean and covariance */
+    Moments(size_t count, Vec const& mean, Mat const& cov)
+    : count(count), mean(mean), m2(cov * (double)count) { };
+
+    void add(Vec const& x)
+    {
+        count++;
+        delta = x - mean;
+        mean += delta / (double)count;
+        residual = x - mean;
+        add_outer(m2, delta, residual);
+    }
+
+    void merge(Moments const& other)
+    {
+        if (other.count == 0)
+            return;
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+
+        double n = (double)(count + other.count);
+        double w = (double)count * other.count / n;
+        Vec d = other.mean - mean;
+        mean += d * (other.count / n);
+        m2 += other.m2 + w * d * d.transpose();
+        count += other.count;
+    }
+
+    /** The covariance, normalized by the number of points */
+    Mat covariance() const { return m2 / (double)count; }
+
+    size_t count = 0;
+    Vec mean;
+    /** Sum of the outer products of the deviations from the mean */
+    Mat m2;
+
+private:
+    /* scratch space, so that dynamic size updates do not allocate */
+    Vec delta;
+    Vec residual;
+};
+
+#endif
+
+#endif
+
+/* EOF */
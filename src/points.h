@@ -0,0 +1,88 @@
+#ifndef POINTS_H
+#define POINTS_H
+
+#ifdef __cplusplus
+#include <iterator>
+#include <vector>
+
+#include <Eigen/Core>
+
+
+/**
+ * A growable list of points of the same dimension, stored contiguously as the
+ * columns of a column-major matrix. The storage grows geometrically, so adding
+ * a point costs no allocation in the amortized case, and the whole list can be
+ * viewed as one matrix without copying.
+ */
+class Points {
+public:
+    using Column = Eigen::Map<Eigen::VectorXd>;
+    using ConstColumn = Eigen::Map<const Eigen::VectorXd>;
+    using ConstMatrix = Eigen::Map<const Eigen::MatrixXd>;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ConstColumn;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = ConstColumn;
+
+        const_iterator(Points const* points, size_t i) : points(points), i(i) { };
+
+        ConstColumn operator*() const { return (*points)[i]; }
+        const_iterator & operator++() { i++; return *this; }
+        bool operator==(const_iterator const& other) const { return i == other.i; }
+        bool operator!=(const_iterator const& other) const { return i != other.i; }
+
+    private:
+        Points const* points;
+        size_t i;
+    };
+
+    Points() = default;
+    explicit Points(Eigen::Index dim) : n_dim(dim) { };
+
+    Eigen::Index dim() const { return n_dim; }
+    size_t size() const { return n_dim ? values.size() / n_dim : 0; }
+    bool empty() const { return values.empty(); }
+
+    void reserve(size_t n) { values.reserve(n * n_dim); }
+    void clear() { values.clear(); }
+
+    void push_back(Eigen::Ref<const Eigen::VectorXd> const& x)
+    {
+        if (!n_dim)
+            n_dim = x.size();
+        values.insert(values.end(), x.data(), x.data() + n_dim);
+    }
+
+    void append(Points const& other)
+    {
+        if (!n_dim)
+            n_dim = other.n_dim;
+        values.insert(values.end(), other.values.begin(), other.values.end());
+    }
+
+    Column operator[](size_t i) { return Column(values.data() + i * n_dim, n_dim); }
+    ConstColumn operator[](size_t i) const { return ConstColumn(values.data() + i * n_dim, n_dim); }
+    ConstColumn front() const { return (*this)[0]; }
+    ConstColumn back() const { return (*this)[size() - 1]; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    /** A view of all points as the columns of a matrix */
+    ConstMatrix matrix() const { return ConstMatrix(values.data(), n_dim, size()); }
+    double const* data() const { return values.data(); }
+
+private:
+    Eigen::Index n_dim = 0;
+    std::vector<double, Eigen::aligned_allocator<double>> values;
+};
+
+#endif
+
+#endif
+
+/* EOF */
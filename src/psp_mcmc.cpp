@@ -1,21 +1,38 @@
 #include <cmath>
 #include <stdexcept>
 #include <algorithm>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
 #include <unordered_set>
 #include <vector>
-#include <random>
 
 #define PI 3.14159265358979323846264338327950288
 
 #include <time.h>       /* time */
-#define TIME_NOW time(NULL)
 
 #include "debug.h"
 #include "psp_mcmc.h"
-#include <unsupported/Eigen/MatrixFunctions>
+#include "checkpoint.h"
+#include "moments.h"
+#include "registry.h"
+#include "rng.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
 
 using namespace Eigen;
 
+using Clock = std::chrono::steady_clock;
+
+static inline
+double seconds_since(Clock::time_point t)
+{
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
 
 struct MarkovChain {
     MarkovChain(int sampleCount = 0, double optJump = 0, int level = 0, int alp = 0)
@@ -31,56 +48,217 @@ struct MarkovChain {
     int alp;
 };
 
+/* Level of a chain retired by the convergence criterion, which is never advanced again */
+static const int RETIRED_LEVEL = 3;
+
+/* Number of points of a design evaluated at once */
+static const size_t CHUNK_SIZE = 1 << 16;
+
+/**
+ * The sampler is instantiated for each point dimension N up to
+ * `PSP_MAX_FIXED_DIM`, so that the chain states, proposals and moment
+ * accumulators of small problems live in fixed size vectors and matrices.
+ * Other dimensions use the dynamic instantiation, N = Eigen::Dynamic.
+ */
+#define PSP_MAX_FIXED_DIM 8
+
+template <int N>
 struct Region {
-    Region(Point x,
+    using Vec = Matrix<double, N, 1>;
+    using Mat = Matrix<double, N, N>;
+
+    Region(Ref<const Point> const& x,
            Pattern pattern)
     :
-    xs(Points{x}), pattern(pattern), mc({})
+    current(x), pattern(pattern), moments(x.size()), mc({})
     {
-        int nDim = x.size();
-        xsum = VectorXd::Zero(nDim);
-        xcsum = MatrixXd::Zero(nDim, nDim);
     };
 
-    Points xs;
+    Vec current;
     Pattern pattern;
-    VectorXd xsum;
-    MatrixXd xcsum;
+    Moments<N> moments;
     MarkovChain mc;
+};
 
-    friend struct Regions;
+/**
+ * Keeps the Markov chains ordered by (level, sampleCount, index), along with
+ * the multiset of all sample counts, so that scheduling queries run in
+ * O(log R) and each change to a chain is applied in O(log R). Retired chains
+ * are left out of both. A changed chain moves its nodes to their new places
+ * rather than freeing and allocating them again.
+ */
+struct ChainQueue {
+    using Key = std::tuple<int, int, int>;
 
-private:
-    Region(Points xs,
-           Pattern pattern,
-           VectorXd xsum,
-           MatrixXd xcsum,
-           MarkovChain mc)
-    :
-    xs(xs), pattern(pattern), xsum(xsum), xcsum(xcsum), mc(mc)
-    { };
+    std::set<Key> byLevel;
+    std::multiset<int> counts;
+    std::vector<Key> keys;
+
+    void push_back(int level, int count)
+    {
+        keys.push_back(Key{ RETIRED_LEVEL, count, (int)keys.size() });
+        update(keys.size() - 1, level, count);
+    }
+
+    void update(int i, int level, int count)
+    {
+        Key & key = keys[i];
+        if (std::get<0>(key) == level && std::get<1>(key) == count)
+            return;
+
+        Key old = key;
+        key = Key{ level, count, i };
+
+        if (std::get<0>(old) == RETIRED_LEVEL) {
+            if (level != RETIRED_LEVEL) {
+                byLevel.insert(key);
+                counts.insert(count);
+            }
+            return;
+        }
+
+        auto keyNode = byLevel.extract(old);
+        auto countNode = counts.extract(counts.find(std::get<1>(old)));
+        if (level != RETIRED_LEVEL) {
+            keyNode.value() = key;
+            countNode.value() = count;
+            byLevel.insert(std::move(keyNode));
+            counts.insert(std::move(countNode));
+        }
+    }
+
+    bool empty() const { return byLevel.empty(); }
+    int minLevel() const { return std::get<0>(*byLevel.begin()); }
+    int minCount() const { return *counts.begin(); }
+    int maxCount() const { return *counts.rbegin(); }
 };
 
+/* Numbers of the random streams drawn from by each chain and each volume estimate */
+static inline
+uint64_t chain_stream(int regionIdx)
+{
+    return (uint64_t)regionIdx;
+}
+
+static inline
+uint64_t volume_stream(int regionIdx)
+{
+    return (uint64_t)1 << 32 | (uint64_t)regionIdx;
+}
+
+static inline
+uint64_t reservoir_stream(int regionIdx)
+{
+    return (uint64_t)2 << 32 | (uint64_t)regionIdx;
+}
+
+static inline
+uint64_t exploration_stream()
+{
+    return (uint64_t)3 << 32;
+}
+
+/**
+ * Decides which of the samples accepted by a chain are kept in its list of
+ * points, as set by `PSP_Options::retention`. Applied as the samples are
+ * drawn, so that the memory used by a bounded policy does not grow with the
+ * length of the search.
+ */
+struct SampleRetention {
+    PSP_Retention mode;
+    size_t size;
+
+    /* Offers the n-th sample accepted by a chain, counting from 0 */
+    void offer(Points & xs, RandomStream & rng, size_t n,
+               Ref<const Point> const& y) const
+    {
+        switch (mode) {
+        default:
+        case PSP_RETAIN_ALL:
+            xs.push_back(y);
+            break;
+
+        case PSP_RETAIN_THIN:
+            if (n % size == 0) {
+                xs.push_back(y);
+            }
+            break;
+
+        case PSP_RETAIN_RESERVOIR:
+            if (n < size) {
+                xs.push_back(y);
+            } else {
+                size_t j = (size_t)(rng.uniform() * (n + 1));
+                if (j < size) {
+                    xs[j] = y;
+                }
+            }
+            break;
+
+        case PSP_RETAIN_NONE:
+            break;
+        }
+    }
+};
+
+template <int N>
 struct Regions {
+    using Vec = typename Region<N>::Vec;
+    using Mat = typename Region<N>::Mat;
+
+    Regions(uint64_t seed, SampleRetention retention)
+    : seed(seed), retention(retention) { };
+
     std::vector<Points> xs;
+    std::vector<Vec, aligned_allocator<Vec>> current;
     std::vector<Pattern> patterns;
-    std::vector<VectorXd> xsum;
-    std::vector<MatrixXd> xcsum;
+    std::vector<Moments<N>, aligned_allocator<Moments<N>>> moments;
+    std::vector<Moments<N>, aligned_allocator<Moments<N>>> cycleMoments;
     std::vector<int> sampleCount;
     std::vector<double> optJump;
     std::vector<int> levels;
     std::vector<int> alps;
+    std::vector<RandomStream> rngs;
+    std::vector<size_t> accepted;
+    std::vector<RandomStream> reservoirRngs;
+    /* Cholesky factors shaping the jumps of the chains, where `shaped` is set */
+    std::vector<Mat, aligned_allocator<Mat>> shapes;
+    std::vector<char> shaped;
+    ChainQueue queue;
+    uint64_t seed;
+    SampleRetention retention;
+    size_t numPoints = 0;
 
-    void push_back(Region new_region)
+    void push_back(Region<N> new_region)
     {
-        xs.push_back(new_region.xs);
+        int i = size();
+        queue.push_back(new_region.mc.level, new_region.mc.sampleCount);
+        xs.push_back(Points(new_region.current.size()));
+        current.push_back(new_region.current);
         patterns.push_back(new_region.pattern);
-        xsum.push_back(new_region.xsum);
-        xcsum.push_back(new_region.xcsum);
+        moments.push_back(new_region.moments);
+        cycleMoments.push_back(new_region.moments);
         sampleCount.push_back(new_region.mc.sampleCount);
         optJump.push_back(new_region.mc.optJump);
         levels.push_back(new_region.mc.level);
         alps.push_back(new_region.mc.alp);
+        rngs.emplace_back(seed, chain_stream(i));
+        accepted.push_back(0);
+        reservoirRngs.emplace_back(seed, reservoir_stream(i));
+        shapes.emplace_back();
+        shaped.push_back(false);
+        if (retention.mode == PSP_RETAIN_RESERVOIR) {
+            xs[i].reserve(retention.size);
+        }
+        retain(i, new_region.current);
+    }
+
+    /* Records a sample accepted by chain i, the starting point included */
+    void retain(int i, Ref<const Point> const& y)
+    {
+        numPoints -= xs[i].size();
+        retention.offer(xs[i], reservoirRngs[i], accepted[i]++, y);
+        numPoints += xs[i].size();
     }
 
     int size()
@@ -88,17 +266,286 @@ struct Regions {
         return xs.size();
     }
 
-    Region operator[](int i)
+    /* Must be called after changing the level or sample count of a chain */
+    void sync(int i)
     {
-        return { xs[i], patterns[i], xsum[i], xcsum[i], { sampleCount[i], optJump[i], levels[i], alps[i] } };
+        queue.update(i, levels[i], sampleCount[i]);
     }
 };
 
+/**
+ * Tracks how much of the sampled points of each region has been written to
+ * the checkpoint file, so that each checkpoint only appends what is new.
+ */
+struct CheckpointProgress {
+    std::vector<size_t> points;
+    std::vector<size_t> accepted;
+};
+
+/**
+ * Writes the inputs of a search, with the seed it was given and its owner
+ * token in the pattern registry, as the header of a checkpoint file.
+ */
+static
+void save_header(RecordWriter & out, MatrixXd const& x0, MatrixX2d const& xBounds,
+                 PSP_Options const& options, uint64_t owner)
+{
+    out.put<int64_t>(xBounds.rows());
+    out.put<int64_t>(x0.cols());
+    out.put(xBounds.data(), xBounds.size());
+    out.put(x0.data(), x0.size());
+
+    out.put<int32_t>(options.maxPsp);
+    out.put(options.iniJmp);
+    out.put(options.smpSz1);
+    out.put(options.smpSz2);
+    out.put(options.vsmpsz);
+    out.put<uint8_t>(options.accurateVolEst);
+    out.put<uint32_t>(options.maxPatterns);
+    out.put<uint32_t>(options.numThreads);
+    out.put<uint32_t>(options.batchSize);
+    out.put<uint64_t>(options.seed);
+    out.put<int32_t>(options.retention);
+    out.put<uint32_t>(options.retentionSize);
+    out.put<uint32_t>(options.checkpointInterval);
+    out.put(options.convergenceTol);
+    out.put<uint64_t>(options.maxEvaluations);
+    out.put(options.maxSeconds);
+    out.put<uint64_t>(options.maxSampleBytes);
+    out.put(options.progressInterval);
+    out.put<int32_t>(options.boundary);
+    out.put<uint32_t>(options.speculation);
+    out.put<int32_t>(options.proposal);
+    out.put<int32_t>(options.volumeSequence);
+    out.put<uint64_t>(options.explorationSize);
+    std::string registryFile = options.registryFile ? options.registryFile : "";
+    out.put<uint64_t>(registryFile.size());
+    out.put(registryFile.data(), registryFile.size());
+    out.put(owner);
+    out.commit(CHECKPOINT_HEADER);
+}
+
+static
+void load_header(RecordReader & in, MatrixXd & x0, MatrixX2d & xBounds,
+                 PSP_Options & options, std::string & registryFile, uint64_t & owner)
+{
+    int64_t nDim = in.get<int64_t>();
+    int64_t nStart = in.get<int64_t>();
+    if (nDim <= 0 || nStart < 0) {
+        throw PSP::checkpoint_error("invalid header");
+    }
+    xBounds.resize(nDim, 2);
+    x0.resize(nDim, nStart);
+    in.get(xBounds.data(), xBounds.size());
+    in.get(x0.data(), x0.size());
+
+    options = {};
+    options.maxPsp = in.get<int32_t>();
+    in.get(options.iniJmp);
+    in.get(options.smpSz1);
+    in.get(options.smpSz2);
+    in.get(options.vsmpsz);
+    options.accurateVolEst = in.get<uint8_t>();
+    options.maxPatterns = in.get<uint32_t>();
+    options.numThreads = in.get<uint32_t>();
+    options.batchSize = in.get<uint32_t>();
+    options.seed = in.get<uint64_t>();
+    options.retention = (PSP_Retention)in.get<int32_t>();
+    options.retentionSize = in.get<uint32_t>();
+    options.checkpointInterval = in.get<uint32_t>();
+    in.get(options.convergenceTol);
+    options.maxEvaluations = in.get<uint64_t>();
+    in.get(options.maxSeconds);
+    options.maxSampleBytes = in.get<uint64_t>();
+    in.get(options.progressInterval);
+    options.boundary = (PSP_Boundary)in.get<int32_t>();
+    options.speculation = in.get<uint32_t>();
+    options.proposal = (PSP_Proposal)in.get<int32_t>();
+    options.volumeSequence = (PSP_Sequence)in.get<int32_t>();
+    options.explorationSize = in.get<uint64_t>();
+    registryFile.resize(in.get<uint64_t>());
+    in.get(&registryFile[0], registryFile.size());
+    options.registryFile = registryFile.empty() ? nullptr : registryFile.c_str();
+    in.get(owner);
+}
+
+/**
+ * Appends the state of every chain to the checkpoint file, together with the
+ * points sampled since the last checkpoint. A reservoir that had points
+ * replaced since then is written out again in full.
+ */
+template <int N>
+static
+void save_state(RecordWriter & out, Regions<N> const& regions,
+                CheckpointProgress & saved, int numTrials, uint64_t numEvaluations)
+{
+    /* every start pattern may have been claimed by other searches */
+    Index nDim = regions.current.empty() ? 0 : regions.current.front().size();
+
+    out.put<int64_t>(numTrials);
+    out.put(numEvaluations);
+    out.put<int64_t>(regions.xs.size());
+
+    for (size_t i = 0; i < regions.xs.size(); i++) {
+        if (i == saved.points.size()) {
+            saved.points.push_back(0);
+            saved.accepted.push_back(0);
+        }
+
+        Moments<N> const& moments = regions.moments[i];
+        out.put(regions.patterns[i]);
+        out.put(regions.current[i].data(), nDim);
+        out.put<uint64_t>(moments.count);
+        out.put(moments.mean.data(), nDim);
+        out.put(moments.m2.data(), nDim * nDim);
+        Moments<N> const& cycleMoments = regions.cycleMoments[i];
+        out.put<uint64_t>(cycleMoments.count);
+        out.put(cycleMoments.mean.data(), nDim);
+        out.put(cycleMoments.m2.data(), nDim * nDim);
+        out.put<int32_t>(regions.sampleCount[i]);
+        out.put(regions.optJump[i]);
+        out.put<int32_t>(regions.levels[i]);
+        out.put<int32_t>(regions.alps[i]);
+        out.put(regions.rngs[i].position());
+        out.put<uint64_t>(regions.accepted[i]);
+        out.put(regions.reservoirRngs[i].position());
+
+        Points const& xs = regions.xs[i];
+        bool replace = regions.retention.mode == PSP_RETAIN_RESERVOIR
+                       && regions.accepted[i] > regions.retention.size
+                       && regions.accepted[i] != saved.accepted[i];
+        size_t from = replace ? 0 : saved.points[i];
+        out.put<uint8_t>(replace);
+        out.put<uint64_t>(xs.size() - from);
+        out.put(xs.data() + from * nDim, (xs.size() - from) * nDim);
+
+        saved.points[i] = xs.size();
+        saved.accepted[i] = regions.accepted[i];
+    }
+
+    out.commit(CHECKPOINT_STATE);
+}
+
+/** Applies a record written by `save_state` on top of the previous ones */
+template <int N>
+static
+void load_state(RecordReader & in, Regions<N> & regions,
+                CheckpointProgress & saved, int & numTrials, uint64_t & numEvaluations,
+                Index nDim)
+{
+    numTrials = in.get<int64_t>();
+    in.get(numEvaluations);
+    int64_t size = in.get<int64_t>();
+    if (size < regions.size()) {
+        throw PSP::checkpoint_error("invalid state");
+    }
+
+    std::vector<double> values;
+    for (int i = 0; i < size; i++) {
+        Pattern pattern = in.get<Pattern>();
+        bool created = i == regions.size();
+        if (created) {
+            Point zero = Point::Zero(nDim);
+            regions.push_back({ zero, pattern });
+            saved.points.push_back(0);
+            saved.accepted.push_back(0);
+        }
+
+        Moments<N> & moments = regions.moments[i];
+        in.get(regions.current[i].data(), nDim);
+        moments.count = in.get<uint64_t>();
+        in.get(moments.mean.data(), nDim);
+        in.get(moments.m2.data(), nDim * nDim);
+        Moments<N> & cycleMoments = regions.cycleMoments[i];
+        cycleMoments.count = in.get<uint64_t>();
+        in.get(cycleMoments.mean.data(), nDim);
+        in.get(cycleMoments.m2.data(), nDim * nDim);
+        regions.sampleCount[i] = in.get<int32_t>();
+        in.get(regions.optJump[i]);
+        regions.levels[i] = in.get<int32_t>();
+        regions.alps[i] = in.get<int32_t>();
+        regions.rngs[i].seek(in.get<uint64_t>());
+        regions.accepted[i] = in.get<uint64_t>();
+        regions.reservoirRngs[i].seek(in.get<uint64_t>());
+
+        Points & xs = regions.xs[i];
+        bool replace = in.get<uint8_t>();
+        values.resize(in.get<uint64_t>() * nDim);
+        in.get(values.data(), values.size());
+        regions.numPoints -= xs.size();
+        if (replace || created) {
+            xs.clear();
+        }
+        for (size_t j = 0; j < values.size(); j += nDim) {
+            xs.push_back(Map<const VectorXd>(values.data() + j, nDim));
+        }
+        regions.numPoints += xs.size();
+
+        saved.points[i] = xs.size();
+        saved.accepted[i] = regions.accepted[i];
+        regions.sync(i);
+    }
+}
+
+/* y = b + a * x */
+template <int N>
+static inline
+void mul_add(Matrix<double, N, 1> & y, Matrix<double, N, N> const& a,
+             Matrix<double, N, 1> const& x, Matrix<double, N, 1> const& b)
+{
+    y.noalias() = b + a * x;
+}
+
+static inline
+void mul_add(VectorXd & y, MatrixXd const& a, VectorXd const& x, VectorXd const& b)
+{
+    y.resize(x.size());
+    mul_add(y.data(), a.data(), x.data(), b.data(), x.size());
+}
+
 size_t nDim(PSP_Result const& psp_result)
 {
     return psp_result.xMean.front().rows();
 }
 
+/**
+ * Picks the Markov chain to advance next: the least sampled one among the
+ * regions at the lowest adaptation level. As in the original scan, the first
+ * region is also picked if it has no more samples than that chain.
+ */
+template <int N>
+static inline
+int select_region(Regions<N> & regions)
+{
+    auto const& best = *regions.queue.byLevel.begin();
+
+    if (regions.levels[0] != std::get<0>(best) &&
+        regions.levels[0] != RETIRED_LEVEL &&
+        regions.sampleCount[0] <= std::get<1>(best)) {
+        return 0;
+    }
+    return std::get<2>(best);
+}
+
+/**
+ * Picks every Markov chain that still has samples to take: all chains that are
+ * adapting, and the adapted ones that have not yet taken the `maxpspp` samples
+ * the search ends with. These chains are independent of each other and can be
+ * stepped concurrently, so a chain adapting to a newly found region does not
+ * leave the others idle while it catches up.
+ */
+template <int N>
+static inline
+void select_sweep(Regions<N> & regions, int maxpspp, std::vector<int> & sweep)
+{
+    sweep.clear();
+    for (auto const& key : regions.queue.byLevel) {
+        if (std::get<0>(key) < 2 || std::get<1>(key) <= maxpspp) {
+            sweep.push_back(std::get<2>(key));
+        }
+    }
+}
+
 /**
  * An implementation of the Markov Chain Monte Carlo Parameter Space
  * Partitioning algorithm described by Pitt, Kim, Navarro, and Myung (2006).
@@ -107,16 +554,26 @@ size_t nDim(PSP_Result const& psp_result)
  *
  * MATLAB code authored by Woojae Kim, Department of Psychology, Ohio State
  * University   $Revision: 3.0 $  $Date: 2005/07/19 $
+ *
+ * With `options.numThreads` set, or with a batch model, the chains are
+ * advanced in sweeps instead of one at a time. The model evaluations of each
+ * sweep are then spread over `numThreads` threads, or submitted to the batch
+ * model in chunks of at most `batchSize` points. A single point model must be
+ * safe to call concurrently in the former case.
  */
-PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options options)
+template <int N>
+static
+PSP_Result psp_mcmc_internal(Model model, BatchModel batchModel,
+                             MatrixXd x0, MatrixX2d xBounds, PSP_Options options,
+                             Progress progress, EvalCount evaluated,
+                             RecordReader* resume, uint64_t owner)
 {
-    std::default_random_engine generator(TIME_NOW);
-    std::normal_distribution<double> randn;
-    std::uniform_real_distribution<double> rand;
+    using Vec = typename Region<N>::Vec;
+    using Mat = typename Region<N>::Mat;
 
-    Point xMin = xBounds.col(0);
-    Point xMax = xBounds.col(1);
-    VectorXd xRange = xMax - xMin;
+    Vec xMin = xBounds.col(0);
+    Vec xMax = xBounds.col(1);
+    Vec xRange = xMax - xMin;
     if (x0.rows() != xBounds.rows()) {
         throw std::invalid_argument("Dimension mismatch.");
     }
@@ -136,80 +593,341 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
     int smpSz1 = options.smpSz1 <= 0 ? ceil(100 * pow(1.2, nDim)) : options.smpSz1;
     int smpSz2 = options.smpSz2 <= 0 ? ceil(200 * pow(1.2, nDim)) : options.smpSz2;
     int vsmpsz = options.vsmpsz <= 0 ? ceil(500 * pow(1.2, nDim)) : options.vsmpsz;
+    int numThreads = options.numThreads;
+    size_t batchSize = options.batchSize <= 0 ? 256 : options.batchSize;
+    uint64_t seed = options.seed == 0 ? time(NULL) : options.seed;
+    SampleRetention retention{ options.retention, options.retentionSize };
+    if (retention.size <= 0) {
+        retention.size = options.retention == PSP_RETAIN_RESERVOIR ? 1000 : 10;
+    }
+    double checkpointInterval = options.checkpointInterval <= 0 ? 60 : options.checkpointInterval;
+    double convergenceTol = options.convergenceTol;
+    auto deadline = Clock::now() + std::chrono::duration<double>(options.maxSeconds);
+    double progressInterval = options.progressInterval <= 0 ? 1 : options.progressInterval;
+    size_t speculation = options.speculation <= 0 ? 1 : options.speculation;
+
+    ThreadPool pool(numThreads > 1 ? numThreads : 1);
+
+    PSP_Status status = PSP_STATUS_COMPLETE;
+    uint64_t numEvaluations = 0;
+
+    auto in_bounds = [&](Vec const& y) {
+        return (xMin.array() <= y.array()).all() && (y.array() <= xMax.array()).all();
+    };
+
+    /* Brings a proposal that left the bounds back in, as set by `boundary` */
+    auto fold = [&](Vec & y) {
+        if (options.boundary == PSP_BOUNDARY_REJECT || in_bounds(y))
+            return;
+
+        for (int d = 0; d < nDim; d++) {
+            double range = xRange[d];
+            if (range <= 0) {
+                y[d] = xMin[d];
+                continue;
+            }
+            double period = options.boundary == PSP_BOUNDARY_REFLECT ? 2 * range : range;
+            double t = fmod(y[d] - xMin[d], period);
+            if (t < 0)
+                t += period;
+            if (t > range)
+                t = period - t;
+            y[d] = xMin[d] + t;
+        }
+        /* rounding may land just outside */
+        y = y.cwiseMax(xMin).cwiseMin(xMax);
+    };
+
+    /* buffers of the batches, reused so that submitting a batch does not allocate */
+    Points batch(nDim);
+    std::vector<size_t> batchIdxs;
+    std::vector<Pattern> batchPtns;
+
+    /* Submits the valid points to the batch model in chunks of `batchSize` */
+    auto evaluate_batches = [&](Points const& ys,
+                                std::vector<char> const& valid,
+                                std::vector<Pattern> & ptns) {
+        batch.clear();
+        batchIdxs.clear();
+        batch.reserve(std::min(ys.size(), batchSize));
+
+        for (size_t i = 0; i < ys.size(); i++) {
+            if (valid[i]) {
+                batch.push_back(ys[i]);
+                batchIdxs.push_back(i);
+            }
+
+            if (batch.size() == batchSize || (i == ys.size() - 1 && !batch.empty())) {
+                batchPtns.assign(batch.size(), 0);
+                batchModel(batch, batchPtns);
+                for (size_t j = 0; j < batch.size(); j++) {
+                    ptns[batchIdxs[j]] = batchPtns[j];
+                }
+                batch.clear();
+                batchIdxs.clear();
+            }
+        }
+    };
+
+    /* Evaluates the model at every valid point, concurrently if possible */
+    auto evaluate = [&](Points const& ys,
+                        std::vector<char> const& valid,
+                        std::vector<Pattern> & ptns) {
+        ptns.assign(ys.size(), 0);
+        size_t before = evaluated ? evaluated() : 0;
+
+        if (!batchModel) {
+            pool.parallel_for(ys.size(), [&](size_t i) {
+                if (valid[i]) {
+                    ptns[i] = model(ys[i]);
+                }
+            });
+        } else {
+            evaluate_batches(ys, valid, ptns);
+        }
+
+        numEvaluations += evaluated ? evaluated() - before
+                                    : std::count(valid.begin(), valid.end(), true);
+    };
 
     /* MCMC-based Parameter Space Partitioning Algorithm */
 
     std::unordered_set<Pattern> foundPatterns;
 
-    Regions regions;
-    std::vector<std::pair<time_t, int>> searchTime;
+    Regions<N> regions(seed, retention);
+
+    std::unique_ptr<PatternRegistry> registry;
+    if (options.registryFile) {
+        if (!resume) {
+            owner = PatternRegistry::new_owner();
+        }
+        registry.reset(new PatternRegistry(options.registryFile, owner));
+    }
 
-    time_t t0 = TIME_NOW;
+    /* Records a pattern as found, returning whether this search is to sample it */
+    auto claim = [&](Pattern ptn) {
+        return foundPatterns.insert(ptn).second && (!registry || registry->claim(ptn));
+    };
+
+    /*
+     * Shapes the jumps of a chain after the covariance of its samples up to
+     * the end of the last cycle, rescaled to the volume of the isotropic
+     * jumps so that the adapted jump size keeps its meaning. Chains without
+     * enough samples for a positive definite covariance keep their shape.
+     */
+    auto reshape = [&](int regionIdx) {
+        Moments<N> const& moments = regions.cycleMoments[regionIdx];
+        if (options.proposal != PSP_PROPOSAL_ADAPTIVE || moments.count <= (size_t)nDim)
+            return;
+
+        LLT<Mat> llt(moments.covariance());
+        if (llt.info() != Eigen::Success)
+            return;
+
+        Mat shape = llt.matrixL();
+        double logRatio = xRange.array().log().sum() - shape.diagonal().array().log().sum();
+        regions.shapes[regionIdx] = shape * exp(logRatio / nDim);
+        regions.shaped[regionIdx] = true;
+    };
+    std::vector<std::pair<double, int>> searchTime;
+
+    Clock::time_point t0 = Clock::now();
     int numTrials = 0;
 
     DEBUG_LOG("=================================================================\n"
-              "PSP SEARCH STARTS...\n\n");
+              "PSP SEARCH STARTS... (seed: " << seed << ")\n\n");
+
+    /* Replays the checkpoints of an interrupted search */
+    std::unique_ptr<RecordWriter> checkpoint;
+    CheckpointProgress saved;
+    bool resumed = false;
+    if (resume) {
+        uint32_t type;
+        while (resume->next(type)) {
+            if (type == CHECKPOINT_STATE) {
+                load_state(*resume, regions, saved, numTrials, numEvaluations, nDim);
+                resumed = true;
+            }
+        }
+        for (int i = 0; i < regions.size(); i++) {
+            reshape(i);
+        }
+        for (Pattern ptn : regions.patterns) {
+            foundPatterns.insert(ptn);
+        }
 
-    for (int i = 0; i < x0.cols(); i++) {
-        Point y = x0.col(i);
-        Pattern currPtn = model(y);
+        DEBUG_LOG("Resumed with " << regions.size() << " data patterns found ("
+                  << numTrials << " trials)\n");
+    }
 
-        if (foundPatterns.insert(currPtn).second) {
-            regions.push_back({ y, currPtn });
-            searchTime.push_back({ TIME_NOW - t0, numTrials });
+    if (!resumed) {
+        Points ys(nDim);
+        for (int i = 0; i < x0.cols(); i++) {
+            ys.push_back(x0.col(i));
+        }
+        std::vector<char> valid(ys.size(), true);
+        std::vector<Pattern> ptns;
+        evaluate(ys, valid, ptns);
 
-            DEBUG_LOG("New data pattern found: " << currPtn <<
-                      " at: " << y.transpose() << "\n");
-            DEBUG_LOG("w/ supplied starting point(s), Total elapsed time: " <<
-                      searchTime.back().first << " secs (" << numTrials << " trials)\n");
+        for (size_t i = 0; i < ys.size(); i++) {
+            auto y = ys[i];
+            Pattern currPtn = ptns[i];
+
+            if (claim(currPtn)) {
+                regions.push_back({ y, currPtn });
+                searchTime.push_back({ seconds_since(t0), numTrials });
+
+                DEBUG_LOG("New data pattern found: " << currPtn <<
+                          " at: " << y.transpose() << "\n");
+                DEBUG_LOG("w/ supplied starting point(s), Total elapsed time: " <<
+                          searchTime.back().first << " secs (" << numTrials << " trials)\n");
+            }
+        }
+
+        /*
+         * Evaluates a space-filling design over the bounds, so that the chains
+         * start from every pattern it finds instead of having to walk to them
+         */
+        size_t numExplore = options.explorationSize;
+        if (options.maxEvaluations > 0 && numEvaluations + numExplore > options.maxEvaluations) {
+            numExplore = options.maxEvaluations > numEvaluations
+                         ? options.maxEvaluations - numEvaluations : 0;
+        }
+        if (numExplore > 0) {
+            DEBUG_LOG("\nExploration of " << numExplore << " points begins...\n");
+
+            RandomStream rng(seed, exploration_stream());
+            HaltonSequence halton(nDim, rng);
+            Vec u;
+            u.resize(nDim);
+
+            for (size_t start = 0; start < numExplore && status == PSP_STATUS_COMPLETE; start += CHUNK_SIZE) {
+                size_t n = std::min(CHUNK_SIZE, numExplore - start);
+                ys.clear();
+                for (size_t i = 0; i < n; i++) {
+                    halton.next(u.data());
+                    ys.push_back(xMin + xRange.cwiseProduct(u));
+                }
+                valid.assign(n, true);
+                evaluate(ys, valid, ptns);
+
+                for (size_t i = 0; i < n; i++) {
+                    if (foundPatterns.count(ptns[i])) {
+                        continue;
+                    }
+                    if (foundPatterns.size() > options.maxPatterns) {
+                        status = PSP_STATUS_TOO_MANY_PATTERNS;
+                        break;
+                    }
+                    if (!claim(ptns[i])) {
+                        continue;
+                    }
+                    regions.push_back({ ys[i], ptns[i] });
+                    searchTime.push_back({ seconds_since(t0), numTrials });
+
+                    DEBUG_LOG("New data pattern found: " << ptns[i] <<
+                              " at: " << ys[i].transpose() << "\n");
+                }
+            }
+
+            DEBUG_LOG("...Exploration found " << regions.size() << " data patterns in "
+                      << seconds_since(t0) << " secs.\n");
         }
     }
 
+    /* Steps and time since the last new pattern, and since the chains were last unbalanced */
     int iterCount1 = 0;
     int iterCount2 = 0;
-    int cnt1 = TIME_NOW;
-    int cnt2 = TIME_NOW;
+    Clock::time_point cnt1 = Clock::now();
+    Clock::time_point cnt2 = Clock::now();
+
+    if (options.checkpointFile) {
+        checkpoint.reset(new RecordWriter(options.checkpointFile,
+                                          resume ? resume->end() : 0));
+        if (!resume) {
+            PSP_Options inputs = options;
+            inputs.seed = seed;
+            save_header(*checkpoint, x0, xBounds, inputs, owner);
+        }
+        if (!resumed) {
+            save_state(*checkpoint, regions, saved, numTrials, numEvaluations);
+        }
+    }
+    Clock::time_point lastCheckpoint = Clock::now();
+    Clock::time_point lastProgress = Clock::now();
+    uint64_t lastProgressEvaluations = numEvaluations;
 
     int maxpspp = maxPsp * smpSz2;
-    int minLevel = 0;
+    int minLevel = regions.queue.empty() ? RETIRED_LEVEL : regions.queue.minLevel();
 
-    while (minLevel < 2 ||
-           *std::min_element(regions.sampleCount.begin(),
-                             regions.sampleCount.end()) <= maxpspp) {
-        int regionIdx = 0;
-        for (int i = 0; i < regions.size(); i++) {
-            if (regions.levels[i] == minLevel &&
-                regions.sampleCount[i] < regions.sampleCount[regionIdx]) {
-                regionIdx = i;
-            }
-        }
-        regions.sampleCount[regionIdx]++;
+    /* scratch space of `propose`, sized once so that drawing a jump does not allocate */
+    Vec rnd;
+    Vec jump;
+    rnd.resize(nDim);
+    jump.resize(nDim);
 
-        VectorXd rnd1 = VectorXd::NullaryExpr(nDim, [&]() { return randn(generator); });
-        VectorXd rnd2 = pow(rand(generator), 1 / nDim) * rnd1.normalized();
-        VectorXd jump = xRange.cwiseProduct(iniJmp * pow(2, regions.optJump[regionIdx]) * rnd2);
-        Point y = regions.xs[regionIdx].back() + jump;
+    /* Draws a jump from the current state of a chain into `y` */
+    auto propose = [&](int regionIdx, Vec & y) {
+        RandomStream & rng = regions.rngs[regionIdx];
+        rng.normal(rnd.data(), nDim);
+        jump = rnd / rnd.norm();
+        jump *= pow(rng.uniform(), 1.0 / nDim);
+        jump *= iniJmp * pow(2, regions.optJump[regionIdx]);
         numTrials++;
+        y.resize(nDim);
+        if (regions.shaped[regionIdx]) {
+            mul_add(y, regions.shapes[regionIdx], jump, regions.current[regionIdx]);
+        } else {
+            y = regions.current[regionIdx] + xRange.cwiseProduct(jump);
+        }
+        fold(y);
+    };
 
-        if ((xMin.array() <= y.array()).all() && (y.array() <= xMax.array()).all()) {
-            Pattern currPtn = model(y);
+    /*
+     * Compares the moments of a chain at the end of a cycle with those at the
+     * end of the previous one, and keeps them for the next comparison
+     */
+    auto converged = [&](int regionIdx) {
+        Moments<N> const& moments = regions.moments[regionIdx];
+        Moments<N> const& last = regions.cycleMoments[regionIdx];
 
-            if ((currPtn == regions.patterns[regionIdx])) {
-                regions.xs[regionIdx].push_back(y);
-                regions.alps[regionIdx]++;
-            } else if (foundPatterns.size() > options.maxPatterns) {
-                /* exit if there are too many patterns */
-                throw PSP::too_many_patterns();
-            } else if (foundPatterns.insert(currPtn).second) {
-                regions.push_back({ y, currPtn });
-                searchTime.push_back({ TIME_NOW - t0, numTrials });
+        bool stable = false;
+        if (last.count > 0) {
+            Mat cov = moments.covariance();
+            double meanShift = (moments.mean - last.mean).norm() / xRange.norm();
+            double covShift = (cov - last.covariance()).norm() / cov.norm();
+            stable = meanShift < convergenceTol && covShift < convergenceTol;
+        }
+        return stable;
+    };
 
-                iterCount1 = iterCount2 = 0;
-                cnt1 = cnt2 = TIME_NOW;
+    /* Starts a new region at `y` if its pattern has not been seen before */
+    auto discover = [&](Ref<const Point> const& y, Pattern currPtn) {
+        if (foundPatterns.size() > options.maxPatterns) {
+            /* stop if there are too many patterns */
+            status = PSP_STATUS_TOO_MANY_PATTERNS;
+        } else if (claim(currPtn)) {
+            regions.push_back({ y, currPtn });
+            searchTime.push_back({ seconds_since(t0), numTrials });
 
-                DEBUG_LOG("New data pattern found: " << currPtn << "\n");
-                DEBUG_LOG("PSP, Total elapsed time: " <<
-                          searchTime.back().first << " secs (" << numTrials << " trials)\n");
+            iterCount1 = iterCount2 = 0;
+            cnt1 = cnt2 = Clock::now();
+
+            DEBUG_LOG("New data pattern found: " << currPtn << "\n");
+            DEBUG_LOG("PSP, Total elapsed time: " <<
+                      searchTime.back().first << " secs (" << numTrials << " trials)\n");
+        }
+    };
+
+    /* Applies the outcome of a proposal to its chain and adapts the chain */
+    auto commit = [&](int regionIdx, Ref<const Point> const& y, bool inBounds, Pattern currPtn) {
+        if (inBounds) {
+            if ((currPtn == regions.patterns[regionIdx])) {
+                regions.retain(regionIdx, y);
+                regions.current[regionIdx] = y;
+                regions.alps[regionIdx]++;
+            } else {
+                discover(y, currPtn);
             }
         }
 
@@ -299,42 +1017,217 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
                           << "Cycle #" << tmp << ", Acceptance rate (cumulative): " << acrate << '\n');
             }
 
-            Point lastPoint = regions.xs[regionIdx].back();
-            regions.xsum[regionIdx] += lastPoint;
-            regions.xcsum[regionIdx] += lastPoint * lastPoint.transpose();
+            regions.moments[regionIdx].add(regions.current[regionIdx]);
+
+            if (tmp == ceil(tmp)) {
+                bool stable = convergenceTol > 0 && converged(regionIdx);
+                regions.cycleMoments[regionIdx] = regions.moments[regionIdx];
+                reshape(regionIdx);
+
+                if (stable) {
+                    regions.levels[regionIdx] = RETIRED_LEVEL;
+                    DEBUG_LOG("Sampling in Region #" << regionIdx << " converged after "
+                              << tmp << " cycles.\n");
+                }
+            }
         } break;
         }
 
+        regions.sync(regionIdx);
+
         iterCount1++;
-        minLevel = *std::min_element(regions.levels.begin(), regions.levels.end());
+        if (regions.queue.empty()) {
+            return;
+        }
+        minLevel = regions.queue.minLevel();
 
-        {
-            auto minmaxSmpCnt = std::minmax_element(regions.sampleCount.begin(),
-                                                    regions.sampleCount.end());
+        if (minLevel < 2 || regions.queue.maxCount() - regions.queue.minCount() > 1) {
+            iterCount2 = 0;
+            cnt2 = Clock::now();
+        } else {
+            iterCount2++;
+        }
+    };
 
-            if (minLevel < 2 || *minmaxSmpCnt.second - *minmaxSmpCnt.first > 1) {
-                iterCount2 = 0;
-                cnt2 = TIME_NOW;
-            } else {
-                iterCount2++;
+    /*
+     * Reports the state of the search to the progress callback, given the
+     * time and the number of evaluations since the last report. Returns
+     * whether the callback asked for the search to be cancelled.
+     */
+    std::vector<PSP_Region_Progress> chains;
+    auto report_progress = [&](double interval, uint64_t evaluations) {
+        chains.resize(regions.size());
+        for (int i = 0; i < regions.size(); i++) {
+            /* the acceptances are counted from the start of the cycle while adapting */
+            int cycleSamples = regions.sampleCount[i];
+            if (regions.levels[i] < 2) {
+                cycleSamples %= regions.levels[i] == 0 ? smpSz1 : smpSz2;
             }
+            chains[i].pattern = regions.patterns[i];
+            chains[i].level = regions.levels[i];
+            chains[i].acceptanceRate = cycleSamples > 0
+                                       ? regions.alps[i] / (double)cycleSamples
+                                       : 0;
+            chains[i].samples = regions.moments[i].count;
+        }
+
+        PSP_Progress report = {};
+        report.numRegions = chains.size();
+        report.regions = chains.data();
+        report.trials = numTrials;
+        report.evaluations = numEvaluations;
+        report.evaluationsPerSecond = interval > 0 ? evaluations / interval : 0;
+        report.elapsedSeconds = seconds_since(t0);
+        report.secondsSinceNewPattern = seconds_since(cnt1);
+        report.stepsSinceNewPattern = iterCount1;
+        report.stepsSinceBalanced = iterCount2;
+        return progress(report);
+    };
+
+    /* Checks the budgets, returning how many more evaluations are allowed */
+    auto remaining_budget = [&]() -> uint64_t {
+        if (status != PSP_STATUS_COMPLETE) {
+            return 0;
+        }
+
+        if (options.maxEvaluations > 0 && numEvaluations >= options.maxEvaluations) {
+            status = PSP_STATUS_EVALUATION_BUDGET;
+        } else if (options.maxSeconds > 0 && Clock::now() >= deadline) {
+            status = PSP_STATUS_TIME_BUDGET;
+        } else if (options.maxSampleBytes > 0
+                   && regions.numPoints * nDim * sizeof(double) >= options.maxSampleBytes) {
+            status = PSP_STATUS_MEMORY_BUDGET;
+        }
+
+        if (status != PSP_STATUS_COMPLETE) {
+            return 0;
+        }
+        return options.maxEvaluations > 0 ? options.maxEvaluations - numEvaluations
+                                          : UINT64_MAX;
+    };
+
+    /* buffers of the steps and sweeps, reused so that a step does not allocate */
+    Vec stepY;
+    std::vector<int> sweepIdxs;
+    Points sweepYs(nDim);
+    std::vector<char> sweepValid;
+    std::vector<Pattern> sweepPtns;
+
+    while (!regions.queue.empty() &&
+           (minLevel < 2 || regions.queue.minCount() <= maxpspp)) {
+        if (progress && seconds_since(lastProgress) >= progressInterval) {
+            if (report_progress(seconds_since(lastProgress), numEvaluations - lastProgressEvaluations)) {
+                status = PSP_STATUS_CANCELLED;
+            }
+            lastProgress = Clock::now();
+            lastProgressEvaluations = numEvaluations;
+        }
+
+        uint64_t budget = remaining_budget();
+        if (budget == 0) {
+            DEBUG_LOG("\nPSP search stopped early (status " << status << ").\n");
+            break;
+        }
+
+        if (checkpoint && seconds_since(lastCheckpoint) >= checkpointInterval) {
+            save_state(*checkpoint, regions, saved, numTrials, numEvaluations);
+            lastCheckpoint = Clock::now();
         }
 
+        if (numThreads == 0 && !batchModel) {
+            int regionIdx = select_region(regions);
+            regions.sampleCount[regionIdx]++;
+
+            Vec & y = stepY;
+            propose(regionIdx, y);
+            bool inBounds = in_bounds(y);
+            Pattern currPtn = 0;
+            if (inBounds) {
+                size_t before = evaluated ? evaluated() : 0;
+                currPtn = model(y);
+                numEvaluations += evaluated ? evaluated() - before : 1;
+            }
+            commit(regionIdx, y, inBounds, currPtn);
+        } else {
+            size_t spec = std::min<uint64_t>(speculation, budget);
+            std::vector<int> & sweep = sweepIdxs;
+            select_sweep(regions, maxpspp, sweep);
+            if (sweep.size() * spec > budget) {
+                sweep.resize(budget / spec);
+            }
+
+            /* every chain of the sweep proposes `spec` points from where it is */
+            Points & ys = sweepYs;
+            std::vector<char> & valid = sweepValid;
+            std::vector<Pattern> & ptns = sweepPtns;
+            ys.clear();
+            valid.clear();
+            for (int regionIdx : sweep) {
+                for (size_t j = 0; j < spec; j++) {
+                    propose(regionIdx, stepY);
+                    ys.push_back(stepY);
+                    valid.push_back(in_bounds(stepY));
+                }
+            }
+
+            evaluate(ys, valid, ptns);
+
+            /*
+             * The proposals of a chain are taken in order as its next steps,
+             * until one is accepted or the chain adapts its jump. The rest
+             * were not drawn from the state the chain is then in, so they only
+             * serve to find new patterns.
+             */
+            for (size_t k = 0; k < sweep.size(); k++) {
+                int regionIdx = sweep[k];
+                int level = regions.levels[regionIdx];
+                double optJump = regions.optJump[regionIdx];
+                bool stale = false;
+
+                for (size_t j = k * spec; j < (k + 1) * spec; j++) {
+                    if (stale) {
+                        if (valid[j] && ptns[j] != regions.patterns[regionIdx]) {
+                            discover(ys[j], ptns[j]);
+                        }
+                        continue;
+                    }
+
+                    regions.sampleCount[regionIdx]++;
+                    commit(regionIdx, ys[j], valid[j], ptns[j]);
+
+                    stale = (valid[j] && ptns[j] == regions.patterns[regionIdx])
+                            || regions.levels[regionIdx] != level
+                            || regions.optJump[regionIdx] != optJump;
+                }
+            }
+        }
+    }
+
+    if (checkpoint) {
+        save_state(*checkpoint, regions, saved, numTrials, numEvaluations);
     }
 
-    std::vector<Pattern> resultPatterns(regions.patterns);
-    std::vector<Points> resultXs(regions.xs);
     std::vector<VectorXd> resultXMean;
     std::vector<MatrixXd> resultXCovMat;
+    std::vector<size_t> resultXCount;
     resultXMean.reserve(regions.size());
     resultXCovMat.reserve(regions.size());
+    resultXCount.reserve(regions.size());
 
     for (int i = 0; i < regions.size(); i++) {
-        double smpCnt = (double)regions.sampleCount[i];
-        VectorXd xsum = regions.xsum[i];
-        resultXMean.push_back(xsum / smpCnt);
-        resultXCovMat.push_back(regions.xcsum[i] / smpCnt
-                                - (xsum * xsum.transpose()) / smpCnt*smpCnt);
+        Moments<N> moments = regions.moments[i];
+        if (moments.count == 0) {
+            /* stopped before the chain was adapted, so use what it has */
+            for (auto x : regions.xs[i]) {
+                moments.add(x);
+            }
+            if (moments.count == 0) {
+                moments.add(regions.current[i]);
+            }
+        }
+        resultXMean.push_back(moments.mean);
+        resultXCovMat.push_back(moments.covariance());
+        resultXCount.push_back(moments.count);
     }
 
     std::vector<double> logvol(regions.size(), 0);
@@ -343,46 +1236,244 @@ PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options opt
     double offset = nHalf == nFloor
                     ? nHalf * log(PI) - lgamma(nHalf + 1)
                     : nDim * log(2) + lgamma(nFloor + 1) - lgamma(nDim + 1) + nFloor * log(PI);
+    /* the ellipsoid (y - mean)' ((nDim + 2) cov)^-1 (y - mean) <= 1 of each region */
+    std::vector<Mat, aligned_allocator<Mat>> factors(regions.size());
+    std::vector<char> factored(regions.size(), false);
     for (int i = 0; i < regions.size(); i++) {
-        logvol[i] = offset + .5 * (log(nDim + 2)
-            + resultXCovMat[i].eigenvalues().array().log())
-            .sum().real();
+        LLT<Mat> llt(Mat((nDim + 2) * resultXCovMat[i]));
+        if (llt.info() == Eigen::Success) {
+            factors[i] = llt.matrixL();
+            factored[i] = true;
+            logvol[i] = offset + factors[i].diagonal().array().log().sum();
+        } else {
+            logvol[i] = offset + .5 * (log(nDim + 2)
+                + resultXCovMat[i].eigenvalues().array().log())
+                .sum().real();
+        }
     }
 
-    if (options.accurateVolEst) {
+    if (options.accurateVolEst && status == PSP_STATUS_COMPLETE) {
         DEBUG_LOG("\nVolume estimation by hit-or-miss method begins...\n");
 
+        /*
+         * The points of the regions are drawn one region after another, and
+         * evaluated together in chunks, so that the evaluations of small
+         * regions are spread over the threads too
+         */
+        std::vector<int> nHit(regions.size(), 0);
+        Points ys(nDim);
+        std::vector<char> valid;
+        std::vector<int> owners;
+        std::vector<Pattern> ptns;
+
+        auto count_hits = [&]() {
+            evaluate(ys, valid, ptns);
+            for (size_t j = 0; j < ys.size(); j++) {
+                if (valid[j] && ptns[j] == regions.patterns[owners[j]]) {
+                    nHit[owners[j]]++;
+                }
+            }
+            ys.clear();
+            valid.clear();
+            owners.clear();
+        };
+
         for (int i = 0; i < regions.size(); i++) {
-            int nHit = 0;
+            if (!factored[i]) {
+                continue;
+            }
 
             DEBUG_LOG("Estimating the volume of Region #" << i << std::endl);
 
-            MatrixXd sqrtm = ((nDim + 2) * resultXCovMat[i]).sqrt();
+            Vec mean = resultXMean[i];
+            RandomStream rng(seed, volume_stream(i));
+            Vec rnd1;
+            rnd1.resize(nDim);
+            std::vector<double> u(nDim + 1);
+            std::unique_ptr<HaltonSequence> halton;
+            if (options.volumeSequence == PSP_SEQUENCE_HALTON) {
+                halton.reset(new HaltonSequence(nDim + 1, rng));
+            }
+
             for (int j = 0; j < vsmpsz; j++) {
-                VectorXd rnd1 = VectorXd::NullaryExpr(nDim, [&]() { return randn(generator); });
-                VectorXd rnd2 = pow(rand(generator), 1 / nDim) * rnd1.normalized();
-                Point y = resultXMean[i] + sqrtm * rnd2;
-
-                if ((xMin.array() <= y.array()).all() && (y.array() <= xMax.array()).all()) {
-                    Pattern cPtn = model(y);
-                    if (cPtn == regions.patterns[i]) {
-                        nHit++;
+                /* uniform in the unit ball: a normal direction and a radius */
+                if (halton) {
+                    halton->next(u.data());
+                    for (int k = 0; k < nDim; k++) {
+                        rnd1[k] = normal_quantile(u[k]);
                     }
+                } else {
+                    rng.normal(rnd1.data(), nDim);
+                    u[nDim] = rng.uniform();
                 }
+                Vec rnd2 = pow(u[nDim], 1.0 / nDim) * rnd1.normalized();
+                Vec y;
+                mul_add(y, factors[i], rnd2, mean);
+                ys.push_back(y);
+                valid.push_back(in_bounds(y));
+                owners.push_back(i);
             }
 
-            logvol[i] += log(nHit) - log(vsmpsz);
+            if (ys.size() >= CHUNK_SIZE) {
+                count_hits();
+            }
+        }
+        count_hits();
+
+        for (int i = 0; i < regions.size(); i++) {
+            if (factored[i]) {
+                logvol[i] += log(nHit[i]) - log(vsmpsz);
+            }
         }
 
         DEBUG_LOG("...Volume estimation terminated for all regions.\n");
     }
 
-    searchTime.push_back({ TIME_NOW - t0, numTrials });
+    searchTime.push_back({ seconds_since(t0), numTrials });
     DEBUG_LOG("\nPSP SEARCH TERMINATED.\n"
               "TOTAL " << regions.size() << " DATA PATTERNS FOUND.\n"
               "TOTAL " << searchTime.back().first << " secs ("
               << numTrials << " trials) ELASPED.\n"
               "=================================================================\n");
 
-    return { resultPatterns, resultXs, resultXMean, resultXCovMat };
+    /* the sampled points are handed over rather than copied */
+    return { std::move(regions.patterns), std::move(regions.xs), std::move(resultXMean),
+             std::move(resultXCovMat), std::move(resultXCount), std::move(logvol), status };
+}
+
+/**
+ * Dispatches to the sampler instantiated for the dimension of the space, which
+ * is the dimension the handle was created with in `PSP_New`.
+ */
+static
+PSP_Result psp_mcmc_dispatch(Model model, BatchModel batchModel,
+                             MatrixXd x0, MatrixX2d xBounds, PSP_Options options,
+                             Progress progress, EvalCount evaluated,
+                             RecordReader* resume = nullptr, uint64_t owner = 0)
+{
+    static_assert(PSP_MAX_FIXED_DIM == 8, "Update the cases below");
+
+    switch (xBounds.rows()) {
+    case 1: return psp_mcmc_internal<1>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 2: return psp_mcmc_internal<2>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 3: return psp_mcmc_internal<3>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 4: return psp_mcmc_internal<4>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 5: return psp_mcmc_internal<5>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 6: return psp_mcmc_internal<6>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 7: return psp_mcmc_internal<7>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    case 8: return psp_mcmc_internal<8>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    default: return psp_mcmc_internal<Dynamic>(model, batchModel, x0, xBounds, options, progress, evaluated, resume, owner);
+    }
+}
+
+PSP_Result psp_mcmc(Model model, MatrixXd x0, MatrixX2d xBounds, PSP_Options options,
+                    Progress progress, EvalCount evaluated)
+{
+    return psp_mcmc_dispatch(model, nullptr, x0, xBounds, options, progress, evaluated);
+}
+
+PSP_Result psp_mcmc(BatchModel model, MatrixXd x0, MatrixX2d xBounds, PSP_Options options,
+                    Progress progress, EvalCount evaluated)
+{
+    if (!model) {
+        throw std::invalid_argument("Missing batch model.");
+    }
+    return psp_mcmc_dispatch(nullptr, model, x0, xBounds, options, progress, evaluated);
+}
+
+static
+PSP_Result psp_mcmc_resume_internal(Model model, BatchModel batchModel,
+                                    char const* path, Index nDim, Progress progress,
+                                    EvalCount evaluated)
+{
+    RecordReader in(path);
+    uint32_t type;
+    if (!in.next(type) || type != CHECKPOINT_HEADER) {
+        throw PSP::checkpoint_error("missing header");
+    }
+
+    MatrixXd x0;
+    MatrixX2d xBounds;
+    PSP_Options options;
+    std::string registryFile;
+    uint64_t owner;
+    load_header(in, x0, xBounds, options, registryFile, owner);
+    if (xBounds.rows() != nDim) {
+        throw std::invalid_argument("Dimension mismatch.");
+    }
+    options.checkpointFile = path;
+
+    return psp_mcmc_dispatch(model, batchModel, x0, xBounds, options, progress, evaluated, &in, owner);
+}
+
+PSP_Result psp_mcmc_resume(Model model, char const* path, Index nDim, Progress progress,
+                           EvalCount evaluated)
+{
+    return psp_mcmc_resume_internal(model, nullptr, path, nDim, progress, evaluated);
+}
+
+PSP_Result psp_mcmc_resume(BatchModel model, char const* path, Index nDim, Progress progress,
+                           EvalCount evaluated)
+{
+    if (!model) {
+        throw std::invalid_argument("Missing batch model.");
+    }
+    return psp_mcmc_resume_internal(nullptr, model, path, nDim, progress, evaluated);
+}
+
+void psp_result_save(PSP_Result const& result, char const* path)
+{
+    RecordWriter out(path, 0);
+    int64_t nDim = result.xMean.empty() ? 0 : result.xMean.front().rows();
+    out.put(nDim);
+    out.put<int64_t>(result.patterns.size());
+    out.put<int32_t>(result.status);
+
+    for (size_t i = 0; i < result.patterns.size(); i++) {
+        out.put(result.patterns[i]);
+        out.put<uint64_t>(result.xCount[i]);
+        out.put(result.xMean[i].data(), nDim);
+        out.put(result.xCovMat[i].data(), nDim * nDim);
+        out.put(result.logVolume[i]);
+        out.put<uint64_t>(result.xs[i].size());
+        out.put(result.xs[i].data(), result.xs[i].size() * nDim);
+    }
+    out.commit(CHECKPOINT_RESULT);
+}
+
+PSP_Result psp_result_load(char const* path)
+{
+    RecordReader in(path);
+    uint32_t type;
+    if (!in.next(type) || type != CHECKPOINT_RESULT) {
+        throw PSP::checkpoint_error("missing result");
+    }
+
+    int64_t nDim = in.get<int64_t>();
+    int64_t size = in.get<int64_t>();
+    if (nDim < 0 || size < 0 || (size > 0 && nDim == 0)) {
+        throw PSP::checkpoint_error("invalid result");
+    }
+
+    PSP_Result result;
+    result.status = (PSP_Status)in.get<int32_t>();
+    std::vector<double> values;
+    for (int64_t i = 0; i < size; i++) {
+        result.patterns.push_back(in.get<Pattern>());
+        result.xCount.push_back(in.get<uint64_t>());
+        result.xMean.emplace_back(nDim);
+        in.get(result.xMean.back().data(), nDim);
+        result.xCovMat.emplace_back(nDim, nDim);
+        in.get(result.xCovMat.back().data(), nDim * nDim);
+        result.logVolume.push_back(in.get<double>());
+
+        values.resize(in.get<uint64_t>() * nDim);
+        in.get(values.data(), values.size());
+        result.xs.emplace_back(nDim);
+        for (size_t j = 0; j < values.size(); j += nDim) {
+            result.xs.back().push_back(Map<const VectorXd>(values.data() + j, nDim));
+        }
+    }
+
+    return result;
 }
@@ -1,6 +1,7 @@
 #ifndef PSP_MCMC_H
 #define PSP_MCMC_H
 
+#include <stddef.h>
 #ifndef __cplusplus
 #include <stdbool.h>
 #endif
@@ -8,23 +9,44 @@
 #ifdef __cplusplus
 #include <vector>
 #include <functional>
+#include <stdexcept>
+
+#include "psp_config.h"
 
 #define EIGEN_NO_AUTOMATIC_RESIZING
+#if PSP_ENABLE_SIMD
+/* fixed, so that the alignment does not depend on the -m flags of the user */
+#define EIGEN_MAX_ALIGN_BYTES 16
+#else
 #define EIGEN_MALLOC_ALREADY_ALIGNED 0
 #define EIGEN_DONT_VECTORIZE
 #define EIGEN_MAX_ALIGN_BYTES 0
+#endif
 #define EIGEN_MPL2_ONLY
 #include <Eigen/Core>
+#include <Eigen/StdVector>
+#include "points.h"
 
 using Point = Eigen::VectorXd;
-using Points = std::vector<Point>;
 using Pattern = size_t;
-using Model = std::function<Pattern(Point)>;
+/** Takes the point by reference, so that calling it does not copy the point */
+using Model = std::function<Pattern(Eigen::Ref<const Point> const&)>;
+using BatchModel = std::function<void(Points const&, std::vector<Pattern> &)>;
+/** Receives a progress report, and returns true to cancel the search */
+using Progress = std::function<bool(struct PSP_Progress_ const&)>;
+/**
+ * Returns how many points a model that answers some points itself, such as
+ * from a cache, has passed on to the actual sampler so far
+ */
+using EvalCount = std::function<size_t()>;
 
 
 namespace PSP {
-    struct too_many_patterns : public std::exception {
-        using std::exception::exception;
+    struct checkpoint_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+    struct registry_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
     };
 };
 
@@ -34,6 +56,30 @@ extern "C"
 #endif
 
 #define PSP_OPTION_NOT_SET -1
+
+typedef enum PSP_Retention_ {
+    PSP_RETAIN_ALL,
+    PSP_RETAIN_THIN,
+    PSP_RETAIN_RESERVOIR,
+    PSP_RETAIN_NONE
+} PSP_Retention;
+
+typedef enum PSP_Boundary_ {
+    PSP_BOUNDARY_REJECT,
+    PSP_BOUNDARY_REFLECT,
+    PSP_BOUNDARY_WRAP
+} PSP_Boundary;
+
+typedef enum PSP_Proposal_ {
+    PSP_PROPOSAL_ISOTROPIC,
+    PSP_PROPOSAL_ADAPTIVE
+} PSP_Proposal;
+
+typedef enum PSP_Sequence_ {
+    PSP_SEQUENCE_RANDOM,
+    PSP_SEQUENCE_HALTON
+} PSP_Sequence;
+
 typedef struct PSP_Options_ {
     int maxPsp;
     double iniJmp;
@@ -42,14 +88,60 @@ typedef struct PSP_Options_ {
     double vsmpsz;
     bool accurateVolEst;
     unsigned int maxPatterns;
+    unsigned int numThreads;
+    unsigned int batchSize;
+    unsigned long seed;
+    PSP_Retention retention;
+    unsigned int retentionSize;
+    char const* checkpointFile;
+    unsigned int checkpointInterval;
+    double convergenceTol;
+    unsigned long maxEvaluations;
+    double maxSeconds;
+    size_t maxSampleBytes;
+    double progressInterval;
+    PSP_Boundary boundary;
+    unsigned int speculation;
+    PSP_Proposal proposal;
+    PSP_Sequence volumeSequence;
+    unsigned long explorationSize;
+    char const* registryFile;
 } PSP_Options;
 
 typedef enum PSP_Result_Mode_ {
     PSP_RESULT_OVERWRITE,
     PSP_RESULT_APPEND,
-    PSP_RESULT_COMBINE  //XXX: Only correctly combines the lists of sampled points!
+    PSP_RESULT_COMBINE
 } PSP_Result_Mode;
 
+typedef enum PSP_Status_ {
+    PSP_STATUS_COMPLETE,
+    PSP_STATUS_TOO_MANY_PATTERNS,
+    PSP_STATUS_EVALUATION_BUDGET,
+    PSP_STATUS_TIME_BUDGET,
+    PSP_STATUS_MEMORY_BUDGET,
+    PSP_STATUS_CANCELLED
+} PSP_Status;
+
+typedef struct PSP_Region_Progress_ {
+    size_t pattern;
+    int level;
+    double acceptanceRate;
+    size_t samples;
+} PSP_Region_Progress;
+
+typedef struct PSP_Progress_ {
+    size_t numRegions;
+    PSP_Region_Progress const* regions;
+    unsigned long trials;
+    unsigned long evaluations;
+    double evaluationsPerSecond;
+    double elapsedSeconds;
+    double secondsSinceNewPattern;
+    unsigned long stepsSinceNewPattern;
+    unsigned long stepsSinceBalanced;
+} PSP_Progress;
+
 #ifdef __cplusplus
 }
 
@@ -58,11 +150,42 @@ struct PSP_Result {
     std::vector<Points> xs;
     std::vector<Eigen::VectorXd> xMean;
     std::vector<Eigen::MatrixXd> xCovMat;
+    /** Number of samples each mean and covariance was computed from */
+    std::vector<size_t> xCount;
+    /** Natural logarithm of the volume of each region */
+    std::vector<double> logVolume;
+    /** Whether the search ran to completion, or why it was stopped early */
+    PSP_Status status;
 };
 
 size_t nDim(PSP_Result const& psp_result);
 
-PSP_Result psp_mcmc(Model model, Eigen::MatrixXd x0, Eigen::MatrixX2d xBounds, PSP_Options options = PSP_Options());
+/**
+ * Searches for the regions of the model. If `evaluated` is set, only the
+ * points it counts are counted as model evaluations, in the progress reports
+ * and towards `maxEvaluations`; otherwise every point passed to the model is.
+ */
+PSP_Result psp_mcmc(Model model, Eigen::MatrixXd x0, Eigen::MatrixX2d xBounds, PSP_Options options = PSP_Options(),
+                    Progress progress = nullptr, EvalCount evaluated = nullptr);
+PSP_Result psp_mcmc(BatchModel model, Eigen::MatrixXd x0, Eigen::MatrixX2d xBounds, PSP_Options options = PSP_Options(),
+                    Progress progress = nullptr, EvalCount evaluated = nullptr);
+
+/**
+ * Continues the search checkpointed to `path`, with the options it was started
+ * with, from its last complete checkpoint. `nDim` is the dimension the model
+ * expects, which must be the dimension of the checkpointed search.
+ */
+PSP_Result psp_mcmc_resume(Model model, char const* path, Eigen::Index nDim,
+                           Progress progress = nullptr, EvalCount evaluated = nullptr);
+PSP_Result psp_mcmc_resume(BatchModel model, char const* path, Eigen::Index nDim,
+                           Progress progress = nullptr, EvalCount evaluated = nullptr);
+
+/**
+ * Writes a result to `path`, and reads it back, so that the results of
+ * searches run in separate processes can be combined.
+ */
+void psp_result_save(PSP_Result const& result, char const* path);
+PSP_Result psp_result_load(char const* path);
 #endif
 
 #endif
@@ -1,5 +1,9 @@
+#include <string.h>
+
 #include "debug.h"
 #include "pspart.h"
+#include "eval_cache.h"
+#include "moments.h"
 
 
 static int HandleExceptions() noexcept
@@ -16,10 +20,15 @@ static int HandleExceptions() noexcept
         fprintf(stderr, "PSP: Invalid argument: %s.\n", err.what());
         return EINVAL;
     }
-    catch (PSP::too_many_patterns const& err)
+    catch (PSP::checkpoint_error const& err)
     {
-        fprintf(stderr, "PSP: Too many patterns found in model.\n");
-        return PSP_ERR_TOO_MANY_PATTERNS;
+        fprintf(stderr, "PSP: Checkpoint error: %s.\n", err.what());
+        return EIO;
+    }
+    catch (PSP::registry_error const& err)
+    {
+        fprintf(stderr, "PSP: Registry error: %s.\n", err.what());
+        return EIO;
     }
     catch (...)
     {
@@ -33,11 +42,15 @@ struct PSP_Handle_ {
     size_t n_dim;
     PSP_Result psp_regions;
     svm_parameter* svm_params;
+    unsigned int svm_threads;
     PSP_Memory memory;
+    std::unique_ptr<EvalCache> cache;
+    /* whether the last search was in double precision, as are its regions */
+    bool double_coords;
+    /* index of the last region of each pattern in `psp_regions` */
+    std::unordered_map<Pattern, size_t> region_index;
 };
 
-using Point_Fixed = Eigen::VectorX<Fixed>;
-
 static inline
 Point map_coord(PSP_Handle handle, Fixed* coord)
 {
@@ -45,11 +58,19 @@ Point map_coord(PSP_Handle handle, Fixed* coord)
 }
 
 static inline
-Point_Fixed unmap_coord(Point const& coord)
+Point_Fixed unmap_coord(Eigen::Ref<const Point> const& coord)
 {
     return (coord * 65536).cast<Fixed>();
 }
 
+/* Converts into `out`, which is reused so that no memory is allocated */
+static inline
+void unmap_coord(Eigen::Ref<const Point> const& coord, Point_Fixed & out)
+{
+    out.resize(coord.size());
+    out = (coord * 65536).cast<Fixed>();
+}
+
 template <typename T>
 static inline
 void append(std::vector<T> & dest, std::vector<T> src)
@@ -63,6 +84,289 @@ void append(std::vector<T> & dest, std::vector<T> src)
     }
 }
 
+static inline
+void append(Points & dest, Points && src)
+{
+    if (dest.size() == 0) {
+        dest = std::move(src);
+    } else {
+        dest.append(src);
+    }
+}
+
+
+/** Wraps the sampler of a callback, going through the cache of the handle */
+static
+Model make_model(PSP_Handle handle, PSP_Sampling_Callback sampling_callback)
+{
+    EvalCache* cache = handle->cache.get();
+
+    return [sampling_callback, cache](Eigen::Ref<const Point> const& x) {
+        /* scratch space of the thread, as the model is called from several */
+        thread_local Point_Fixed point;
+        unmap_coord(x, point);
+        Pattern ptn;
+        if (cache && cache->lookup(point, ptn))
+            return ptn;
+
+        ptn = sampling_callback->sampler(sampling_callback->sampling_context,
+                                         point.data());
+        if (cache)
+            cache->insert(point, ptn);
+        return ptn;
+    };
+}
+
+/** Wraps the batch sampler of a callback, going through the cache of the handle */
+static
+BatchModel make_batch_model(PSP_Handle handle, PSP_Sampling_Callback sampling_callback)
+{
+    EvalCache* cache = handle->cache.get();
+
+    return [sampling_callback, cache](Points const& xs, std::vector<Pattern> & ptns) {
+        /* scratch space of the thread, grown to the largest batch seen */
+        thread_local Eigen::MatrixX<Fixed> points;
+        thread_local Point_Fixed point;
+        thread_local std::vector<size_t> missed;
+        thread_local std::vector<Pattern> missedPtns;
+
+        if (points.rows() != (Eigen::Index)xs.dim() || points.cols() < (Eigen::Index)xs.size())
+            points.resize(xs.dim(), xs.size());
+        missed.clear();
+        for (size_t i = 0; i < xs.size(); i++) {
+            unmap_coord(xs[i], point);
+            if (!cache || !cache->lookup(point, ptns[i])) {
+                points.col(missed.size()) = point;
+                missed.push_back(i);
+            }
+        }
+        if (missed.empty())
+            return;
+
+        missedPtns.resize(missed.size());
+        sampling_callback->batch_sampler(sampling_callback->sampling_context,
+                                         missed.size(), points.data(), missedPtns.data());
+        for (size_t j = 0; j < missed.size(); j++) {
+            ptns[missed[j]] = missedPtns[j];
+            if (cache)
+                cache->insert(points.col(j), missedPtns[j]);
+        }
+    };
+}
+
+/* Keys the cache on the exact bits of a double precision point */
+static inline
+void cache_key(Eigen::Ref<const Point> const& coord, Point_Fixed & out)
+{
+    static_assert(sizeof(Fixed) == sizeof(double), "Fixed must hold the bits of a double");
+    out.resize(coord.size());
+    memcpy(out.data(), coord.data(), coord.size() * sizeof(double));
+}
+
+/** Wraps the double precision sampler of a callback, going through the cache of the handle */
+static
+Model make_model_double(PSP_Handle handle, PSP_Sampling_Callback sampling_callback)
+{
+    EvalCache* cache = handle->cache.get();
+
+    return [sampling_callback, cache](Eigen::Ref<const Point> const& x) {
+        if (!cache)
+            return sampling_callback->sampler_double(sampling_callback->sampling_context,
+                                                     x.data());
+
+        thread_local Point_Fixed key;
+        cache_key(x, key);
+        Pattern ptn;
+        if (cache->lookup(key, ptn))
+            return ptn;
+
+        ptn = sampling_callback->sampler_double(sampling_callback->sampling_context,
+                                                x.data());
+        cache->insert(key, ptn);
+        return ptn;
+    };
+}
+
+/** Wraps the double precision batch sampler of a callback, going through the cache of the handle */
+static
+BatchModel make_batch_model_double(PSP_Handle handle, PSP_Sampling_Callback sampling_callback)
+{
+    EvalCache* cache = handle->cache.get();
+
+    return [sampling_callback, cache](Points const& xs, std::vector<Pattern> & ptns) {
+        if (!cache) {
+            sampling_callback->batch_sampler_double(sampling_callback->sampling_context,
+                                                    xs.size(), xs.data(), ptns.data());
+            return;
+        }
+
+        /* scratch space of the thread, grown to the largest batch seen */
+        thread_local Points points;
+        thread_local Point_Fixed key;
+        thread_local std::vector<size_t> missed;
+        thread_local std::vector<Pattern> missedPtns;
+
+        if (points.dim() != xs.dim())
+            points = Points(xs.dim());
+        points.clear();
+        missed.clear();
+        for (size_t i = 0; i < xs.size(); i++) {
+            cache_key(xs[i], key);
+            if (!cache->lookup(key, ptns[i])) {
+                points.push_back(xs[i]);
+                missed.push_back(i);
+            }
+        }
+        if (missed.empty())
+            return;
+
+        missedPtns.resize(missed.size());
+        sampling_callback->batch_sampler_double(sampling_callback->sampling_context,
+                                                missed.size(), points.data(), missedPtns.data());
+        for (size_t j = 0; j < missed.size(); j++) {
+            ptns[missed[j]] = missedPtns[j];
+            cache_key(points[j], key);
+            cache->insert(key, missedPtns[j]);
+        }
+    };
+}
+
+/** Wraps the progress callback, if any */
+static
+Progress make_progress(PSP_Sampling_Callback sampling_callback)
+{
+    if (!sampling_callback->progress)
+        return nullptr;
+
+    return [sampling_callback](PSP_Progress const& progress) {
+        return sampling_callback->progress(sampling_callback->sampling_context,
+                                           &progress) != 0;
+    };
+}
+
+/** Counts the points that missed the cache of the handle, if any, and so reached the sampler */
+static
+EvalCount make_eval_count(PSP_Handle handle)
+{
+    EvalCache* cache = handle->cache.get();
+    if (!cache)
+        return nullptr;
+
+    return [cache]() {
+        return cache->misses();
+    };
+}
+
+/**
+ * Runs `search` with the model of a callback, in double precision or in fixed
+ * point, emptying the cache of the handle when switching from one to the other
+ */
+template <typename Search>
+static
+PSP_Result run_search(PSP_Handle handle, PSP_Sampling_Callback sampling_callback,
+                      bool double_coords, Search search)
+{
+    if (handle->cache && handle->double_coords != double_coords)
+        handle->cache->clear();
+    handle->double_coords = double_coords;
+
+    EvalCount evaluated = make_eval_count(handle);
+    if (double_coords)
+        return sampling_callback->batch_sampler_double
+               ? search(make_batch_model_double(handle, sampling_callback), evaluated)
+               : search(make_model_double(handle, sampling_callback), evaluated);
+    return sampling_callback->batch_sampler
+           ? search(make_batch_model(handle, sampling_callback), evaluated)
+           : search(make_model(handle, sampling_callback), evaluated);
+}
+
+/** Indexes the regions of the handle from `from` on by their patterns */
+static
+void index_regions(PSP_Handle handle, size_t from)
+{
+    if (from == 0)
+        handle->region_index.clear();
+    for (size_t i = from; i < handle->psp_regions.patterns.size(); i++) {
+        handle->region_index[handle->psp_regions.patterns[i]] = i;
+    }
+}
+
+/**
+ * Stores the result of a search in the handle, as set by `result_mode`, and
+ * returns the code telling whether the search was stopped early. The sampled
+ * points are moved out of `result`.
+ */
+static
+int store_result(PSP_Handle handle, PSP_Result && result,
+                 PSP_Result_Mode result_mode)
+{
+    PSP_Result & regions = handle->psp_regions;
+    PSP_Status status = result.status;
+    size_t size = regions.patterns.size();
+
+    switch (result_mode) {
+    default:
+    case PSP_RESULT_OVERWRITE:
+        regions = std::move(result);
+        index_regions(handle, 0);
+        break;
+
+    case PSP_RESULT_APPEND:
+        append(regions.patterns, std::move(result.patterns));
+        append(regions.xs, std::move(result.xs));
+        append(regions.xMean, std::move(result.xMean));
+        append(regions.xCovMat, std::move(result.xCovMat));
+        append(regions.xCount, std::move(result.xCount));
+        append(regions.logVolume, std::move(result.logVolume));
+        index_regions(handle, size);
+        break;
+
+    case PSP_RESULT_COMBINE:
+        for (size_t i = 0; i < result.patterns.size(); i++) {
+            auto found = handle->region_index.find(result.patterns[i]);
+
+            if (found == handle->region_index.end()) {
+                handle->region_index.emplace(result.patterns[i], regions.patterns.size());
+                regions.patterns.push_back(result.patterns[i]);
+                regions.xs.push_back(std::move(result.xs[i]));
+                regions.xMean.push_back(std::move(result.xMean[i]));
+                regions.xCovMat.push_back(std::move(result.xCovMat[i]));
+                regions.xCount.push_back(result.xCount[i]);
+                regions.logVolume.push_back(result.logVolume[i]);
+            } else {
+                size_t idx = found->second;
+                Moments<> moments(regions.xCount[idx], regions.xMean[idx], regions.xCovMat[idx]);
+                moments.merge({ result.xCount[i], result.xMean[i], result.xCovMat[i] });
+
+                /* both are estimates of the same volume, weighted by their samples */
+                if (moments.count > 0) {
+                    double & logVolume = regions.logVolume[idx];
+                    logVolume = (logVolume * regions.xCount[idx]
+                                 + result.logVolume[i] * result.xCount[i]) / moments.count;
+                }
+
+                append(regions.xs[idx], std::move(result.xs[i]));
+                regions.xMean[idx] = std::move(moments.mean);
+                regions.xCovMat[idx] = moments.covariance();
+                regions.xCount[idx] = moments.count;
+            }
+        }
+        break;
+    }
+    regions.status = status;
+
+    switch (result.status) {
+    case PSP_STATUS_COMPLETE:
+        return 0;
+    case PSP_STATUS_TOO_MANY_PATTERNS:
+        return PSP_ERR_TOO_MANY_PATTERNS;
+    case PSP_STATUS_CANCELLED:
+        return PSP_ERR_CANCELLED;
+    default:
+        return PSP_ERR_BUDGET_EXHAUSTED;
+    }
+}
+
 
 extern "C"
 PSP_Handle PSP_New(size_t dim)
@@ -102,15 +406,11 @@ int PSP_Get_Regions(PSP_Handle handle,
                     PSP_Options options,
                     PSP_Result_Mode result_mode)
 {
-    if (!handle || !sampling_callback->sampler)
+    if (!handle || !sampling_callback ||
+        !(sampling_callback->sampler || sampling_callback->batch_sampler))
         return EINVAL;
 
     try {
-        auto model = [sampling_callback](Point x) {
-            return sampling_callback->sampler(sampling_callback->sampling_context,
-                                              unmap_coord(x).data());
-        };
-
         Eigen::MatrixXd x0(handle->n_dim, num_start_points);
         for (int i = 0; i < num_start_points; i++) {
             x0.col(i) = map_coord(handle, start_points + i * handle->n_dim);
@@ -118,54 +418,85 @@ int PSP_Get_Regions(PSP_Handle handle,
         Eigen::MatrixX2d xb(handle->n_dim, 2);
         xb << map_coord(handle, min_coords), map_coord(handle, max_coords);
 
-        PSP_Result const& result = psp_mcmc(model, x0, xb, options);
-
-        switch (result_mode) {
-        default:
-        case PSP_RESULT_OVERWRITE:
-            handle->psp_regions = result;
-            break;
-
-        case PSP_RESULT_APPEND:
-            append(handle->psp_regions.patterns, result.patterns);
-            append(handle->psp_regions.xs, result.xs);
-            append(handle->psp_regions.xMean, result.xMean);
-            append(handle->psp_regions.xCovMat, result.xCovMat);
-            break;
-
-        case PSP_RESULT_COMBINE:
-        {
-            std::vector<size_t> idxs(result.patterns.size());
-            std::transform(result.patterns.begin(), result.patterns.end(),
-                           idxs.begin(),
-                           [handle](Pattern const& ptn) {
-                               auto it = std::find(handle->psp_regions.patterns.rbegin(),
-                                                   handle->psp_regions.patterns.rend(),
-                                                   ptn);
-                               return handle->psp_regions.patterns.rend() - it - 1;
-                           });
-
-            for (int i = 0; i < result.patterns.size(); i++) {
-                int idx = idxs[i];
-
-                if (idx == -1) {
-                    handle->psp_regions.patterns.push_back(result.patterns[i]);
-                    handle->psp_regions.xs.push_back(result.xs[i]);
-                    handle->psp_regions.xMean.push_back(result.xMean[i]);
-                    handle->psp_regions.xCovMat.push_back(result.xCovMat[i]);
-                } else {
-                    int a = handle->psp_regions.xs[idx].size();
-                    int b = result.xs[i].size();
-                    Point x = handle->psp_regions.xMean[idx];
-                    Point y = result.xMean[i];
-
-                    append(handle->psp_regions.xs[idx], result.xs[i]);
-                    handle->psp_regions.xMean[idx] = (a*x + b*y) / (a + b);
-                }
-            }
-        }
-            break;
-        }
+        PSP_Result result = run_search(handle, sampling_callback, false,
+                                              [&](auto const& model, EvalCount const& evaluated) {
+            return psp_mcmc(model, x0, xb, options, make_progress(sampling_callback),
+                            evaluated);
+        });
+
+        return store_result(handle, std::move(result), result_mode);
+    } catch (...) {
+        return HandleExceptions();
+    }
+}
+
+extern "C"
+int PSP_Get_Regions_Double(PSP_Handle handle,
+                           PSP_Sampling_Callback sampling_callback,
+                           int num_start_points,
+                           double const* start_points,
+                           double const* min_coords,
+                           double const* max_coords,
+                           PSP_Options options,
+                           PSP_Result_Mode result_mode)
+{
+    if (!handle || !sampling_callback ||
+        !(sampling_callback->sampler_double || sampling_callback->batch_sampler_double))
+        return EINVAL;
+
+    try {
+        Eigen::MatrixXd x0 = Eigen::Map<const Eigen::MatrixXd>(start_points, handle->n_dim,
+                                                               num_start_points);
+        Eigen::MatrixX2d xb(handle->n_dim, 2);
+        xb << Eigen::Map<const Point>(min_coords, handle->n_dim),
+              Eigen::Map<const Point>(max_coords, handle->n_dim);
+
+        PSP_Result result = run_search(handle, sampling_callback, true,
+                                              [&](auto const& model, EvalCount const& evaluated) {
+            return psp_mcmc(model, x0, xb, options, make_progress(sampling_callback),
+                            evaluated);
+        });
+
+        return store_result(handle, std::move(result), result_mode);
+    } catch (...) {
+        return HandleExceptions();
+    }
+}
+
+extern "C"
+int PSP_Resume_Regions(PSP_Handle handle,
+                       PSP_Sampling_Callback sampling_callback,
+                       char const* checkpoint_file,
+                       PSP_Result_Mode result_mode)
+{
+    bool double_coords = sampling_callback &&
+        (sampling_callback->sampler_double || sampling_callback->batch_sampler_double);
+    if (!handle || !sampling_callback || !checkpoint_file ||
+        !(double_coords || sampling_callback->sampler || sampling_callback->batch_sampler))
+        return EINVAL;
+
+    try {
+        PSP_Result result = run_search(handle, sampling_callback, double_coords,
+                                              [&](auto const& model, EvalCount const& evaluated) {
+            return psp_mcmc_resume(model, checkpoint_file, handle->n_dim,
+                                   make_progress(sampling_callback), evaluated);
+        });
+
+        return store_result(handle, std::move(result), result_mode);
+    } catch (...) {
+        return HandleExceptions();
+    }
+}
+
+extern "C"
+int PSP_Save_Regions(PSP_Handle handle,
+                     char const* path)
+{
+    if (!handle || !path)
+        return EINVAL;
+
+    try {
+        psp_result_save(handle->psp_regions, path);
     } catch (...) {
         return HandleExceptions();
     }
@@ -173,15 +504,73 @@ int PSP_Get_Regions(PSP_Handle handle,
     return 0;
 }
 
+extern "C"
+int PSP_Load_Regions(PSP_Handle handle,
+                     char const* path,
+                     PSP_Result_Mode result_mode)
+{
+    if (!handle || !path)
+        return EINVAL;
+
+    try {
+        PSP_Result result = psp_result_load(path);
+        if (!result.xMean.empty() && (size_t)result.xMean.front().rows() != handle->n_dim)
+            throw std::invalid_argument("dimension mismatch");
+
+        return store_result(handle, std::move(result), result_mode);
+    } catch (...) {
+        return HandleExceptions();
+    }
+}
+
+
+extern "C"
+int PSP_Configure_Cache(PSP_Handle handle,
+                        size_t max_bytes)
+{
+    if (!handle)
+        return EINVAL;
+
+    try {
+        if (max_bytes == 0)
+            handle->cache.reset();
+        else
+            handle->cache.reset(new EvalCache(max_bytes));
+    } catch (...) {
+        return HandleExceptions();
+    }
+
+    return 0;
+}
+
+extern "C"
+int PSP_Get_Cache_Stats(PSP_Handle handle,
+                        PSP_Cache_Stats* stats)
+{
+    if (!handle || !stats)
+        return EINVAL;
+
+    *stats = {};
+    if (handle->cache) {
+        stats->hits = handle->cache->hits();
+        stats->misses = handle->cache->misses();
+        stats->entries = handle->cache->size();
+        stats->bytes = handle->cache->bytes();
+    }
+
+    return 0;
+}
 
 extern "C"
 int PSP_Configure_SVM(PSP_Handle handle,
-                      struct svm_parameter* params)
+                      struct svm_parameter* params,
+                      unsigned int num_threads)
 {
     if (!handle)
         return EINVAL;
 
     handle->svm_params = params;
+    handle->svm_threads = num_threads;
 
     return 0;
 }
@@ -196,7 +585,8 @@ int PSP_Build_Partition_KdSVM(PSP_Handle handle,
     try {
         if (!handle->memory)
             handle->memory = new PSP_MemoryRec{};
-        *tree = build_kdsvm(handle->psp_regions, handle->svm_params, handle->memory);
+        *tree = build_kdsvm(handle->psp_regions, handle->svm_params,
+                            handle->svm_threads, handle->memory);
     } catch (...) {
         return HandleExceptions();
     }
@@ -230,10 +620,17 @@ void psp_dump_points(PSP_Handle handle)
     std::cout << "Sampled points dump:\n";
     for (size_t i = 0; i < handle->psp_regions.patterns.size(); i++) {
         std::cout << handle->psp_regions.patterns[i] << ' '
-                  << handle->psp_regions.xs[i].size() << '\n'
-                  << unmap_coord(handle->psp_regions.xMean[i]).transpose() << '\n';
-        for (auto & x : handle->psp_regions.xs[i]) {
-            std::cout << unmap_coord(x).transpose() << '\n';
+                  << handle->psp_regions.xs[i].size() << '\n';
+        if (handle->double_coords) {
+            std::cout << handle->psp_regions.xMean[i].transpose() << '\n';
+            for (auto x : handle->psp_regions.xs[i]) {
+                std::cout << x.transpose() << '\n';
+            }
+        } else {
+            std::cout << unmap_coord(handle->psp_regions.xMean[i]).transpose() << '\n';
+            for (auto x : handle->psp_regions.xs[i]) {
+                std::cout << unmap_coord(x).transpose() << '\n';
+            }
         }
     }
 #endif
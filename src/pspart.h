@@ -5,6 +5,8 @@
 #include <errno.h>
 
 #define PSP_ERR_TOO_MANY_PATTERNS 3000
+#define PSP_ERR_BUDGET_EXHAUSTED 3001
+#define PSP_ERR_CANCELLED 3002
 #define ERR_UNHANDLED_EXCEPTION -1
 
 #include "common.h"
@@ -25,11 +27,38 @@ extern "C"
 typedef size_t (*Sampling_Func)(void* sampling_context,
                                 Fixed* point);
 
+typedef void (*Batch_Sampling_Func)(void* sampling_context,
+                                    size_t num_points,
+                                    Fixed* points,
+                                    size_t* patterns);
+
+typedef int (*Progress_Func)(void* sampling_context,
+                             PSP_Progress const* progress);
+
+typedef size_t (*Sampling_Func_Double)(void* sampling_context,
+                                       double const* point);
+
+typedef void (*Batch_Sampling_Func_Double)(void* sampling_context,
+                                           size_t num_points,
+                                           double const* points,
+                                           size_t* patterns);
+
 typedef struct PSP_Sampling_CallbackRec_ {
     void* sampling_context;
     Sampling_Func sampler;
+    Batch_Sampling_Func batch_sampler;
+    Progress_Func progress;
+    Sampling_Func_Double sampler_double;
+    Batch_Sampling_Func_Double batch_sampler_double;
 } PSP_Sampling_CallbackRec, *PSP_Sampling_Callback;
 
+typedef struct PSP_Cache_Stats_ {
+    size_t hits;
+    size_t misses;
+    size_t entries;
+    size_t bytes;
+} PSP_Cache_Stats;
+
 
 /** Allocates a new instance of PSP */
 PSP_Handle PSP_New(size_t dim);
@@ -41,6 +70,30 @@ void PSP_Close(PSP_Handle handle);
  *
  * - sampling_callback: A closure object representing the model. The function
  *     should accept a point and return a number representing the data pattern.
+ *     If `batch_sampler` is set, it is used instead of `sampler`, and should
+ *     write the data patterns of `num_points` points, stored one after another
+ *     in `points`, to `patterns`. If `progress` is set, it is called from the
+ *     sampling loop every `progressInterval` seconds with a report of the
+ *     search:
+ *     - numRegions, regions: The regions found so far, with the data pattern,
+ *       the adaptation level (0 and 1 while adapting, 2 after, 3 once retired
+ *       by `convergenceTol`), the acceptance rate of the current adaptation
+ *       cycle, or of all samples since adaptation, and the number of samples
+ *       taken after adaptation of each.
+ *     - trials, evaluations: The numbers of proposals and of model evaluations
+ *       so far. Points answered by the cache of the handle are not counted
+ *       as evaluations; `PSP_Get_Cache_Stats` reports them as hits.
+ *     - evaluationsPerSecond: The rate of model evaluations since the last
+ *       report.
+ *     - elapsedSeconds, secondsSinceNewPattern, stepsSinceNewPattern: The time
+ *       since the search started, and the time and number of sampling steps
+ *       since the last new pattern was found.
+ *     - stepsSinceBalanced: The number of steps for which every chain has
+ *       been adapted and the sample counts of the chains have stayed within
+ *       one of each other.
+ *     The report is only valid during the call. Returning nonzero cancels the
+ *     search, which then stops as with a budget and returns
+ *     `PSP_ERR_CANCELLED`.
  *
  * - points: Lists of coordinates in 16-bit fixed point format.
  *
@@ -72,6 +125,112 @@ void PSP_Close(PSP_Handle handle);
  *     - accurateVolEst: Whether or not to perform an additional hit-or-miss
  *       Monte Carlo integration after the search process to estimate the region
  *       volume, which results in a better estimate.
+ *     - maxPatterns: Maximum number of data patterns to be found before the
+ *       search is stopped with `PSP_ERR_TOO_MANY_PATTERNS`.
+ *     - numThreads: Number of threads used to evaluate the model. If set, the
+ *       Markov chains of all regions that are still sampling are advanced
+ *       together in sweeps, and their proposals are evaluated concurrently;
+ *       the sampler must then be safe to call from several threads at once.
+ *       Each sweep steps every chain that is adapting or has not finished
+ *       its `maxPsp` cycles, so the chains adapted earlier keep sampling,
+ *       up to their last cycle, while a newly found one adapts. If not set,
+ *       the chains are advanced one at a time on the calling thread.
+ *     - batchSize: Maximum number of points passed to `batch_sampler` at once.
+ *       With a batch sampler, the chains are always advanced in sweeps as with
+ *       `numThreads`, and each sweep is submitted as one batch. The default
+ *       value is 256.
+ *     - seed: Seed of the random number generator. Each Markov chain, and the
+ *       volume estimation of each region, draws from its own stream derived
+ *       from the seed, so that a search with the same seed, start points and
+ *       options gives the same results for any nonzero `numThreads`. If not
+ *       set, the current time is used.
+ *     - retention: Which of the sampled points of each region are kept in the
+ *       results, which bounds the memory used by long searches. The means and
+ *       covariances of the regions are not affected.
+ *         - PSP_RETAIN_ALL: Every sample is kept. This is the default.
+ *         - PSP_RETAIN_THIN: Every `retentionSize`-th sample is kept.
+ *         - PSP_RETAIN_RESERVOIR: A uniform random subset of at most
+ *           `retentionSize` samples is kept.
+ *         - PSP_RETAIN_NONE: No points are kept, only the moments. The
+ *           partitions cannot be built from such results.
+ *     - retentionSize: The thinning interval, with a default value of 10, or
+ *       the size of the reservoir, with a default value of 1000.
+ *     - checkpointFile: Path of a file to which the state of the search is
+ *       saved periodically, so that it can be continued with
+ *       `PSP_Resume_Regions` if the process is interrupted. Each checkpoint
+ *       only appends the points sampled since the previous one.
+ *     - checkpointInterval: Minimum number of seconds between checkpoints.
+ *       The default value is 60.
+ *     - convergenceTol: If set, the Markov chain of a region is retired early
+ *       once its samples have converged: when, from the end of one cycle of
+ *       `smpSz2` samples after adaptation to the end of the next, the mean of
+ *       the region moves by less than `convergenceTol` times the diagonal of
+ *       the space, and its covariance changes by less than `convergenceTol`
+ *       relative to its norm. Retired regions are no longer sampled, while the
+ *       chains of the other regions go on and may still find new patterns.
+ *       Not set by default.
+ *     - maxEvaluations: Maximum number of model evaluations in the search.
+ *       Points answered by the cache of the handle are not counted.
+ *     - maxSeconds: Maximum wall-clock time of the search, in seconds. The
+ *       volume estimation is not counted.
+ *     - maxSampleBytes: Maximum memory used by the sampled points kept.
+ *     - progressInterval: Minimum number of seconds between calls to the
+ *       `progress` callback. The default value is 1.
+ *     - boundary: What to do with a proposed jump that leaves the box given
+ *       by `min_coords` and `max_coords`.
+ *         - PSP_BOUNDARY_REJECT: The proposal is discarded without evaluating
+ *           the model, but still counts as a sample. This is the default.
+ *         - PSP_BOUNDARY_REFLECT: The proposal is mirrored back into the box
+ *           at the bounds it crosses.
+ *         - PSP_BOUNDARY_WRAP: The proposal is wrapped around to the other
+ *           side of the box, as if it were periodic.
+ *       Both REFLECT and WRAP keep the proposals symmetric, and every
+ *       proposal is then evaluated.
+ *     - speculation: Number of proposals each Markov chain makes at once from
+ *       its current point, all evaluated together, to hide the latency of the
+ *       model behind `numThreads` or `batch_sampler`. The chain takes them in
+ *       order as its next steps, up to the first one accepted, which is what
+ *       it would have done one step at a time. The later proposals still
+ *       count towards finding new patterns. The default value is 1. Ignored
+ *       if `numThreads` is 0 and there is no batch sampler.
+ *     - proposal: The shape of the jumps proposed by the Markov chains.
+ *         - PSP_PROPOSAL_ISOTROPIC: Uniform in a ball, stretched along each
+ *           axis by the range of the bounds. This is the default.
+ *         - PSP_PROPOSAL_ADAPTIVE: Once a chain has finished its adaptation,
+ *           its jumps are shaped after the covariance of the samples of its
+ *           region, updated every `smpSz2` samples, and keep the size it
+ *           was adapted to. This raises the acceptance rate in elongated or
+ *           thin regions. Until then, or while the covariance is degenerate,
+ *           the isotropic jumps are used.
+ *     - volumeSequence: The points drawn in each region by `accurateVolEst`.
+ *         - PSP_SEQUENCE_RANDOM: Pseudo-random points. This is the default.
+ *         - PSP_SEQUENCE_HALTON: Points of a scrambled Halton sequence,
+ *           which cover the region more evenly, so that a smaller `vsmpsz`
+ *           gives an estimate as accurate.
+ *     - explorationSize: If set, the model is first evaluated at this many
+ *       points of a scrambled Halton sequence spread over the bounds, in
+ *       batches, and every pattern found seeds a region before the Markov
+ *       chains start. Small regions far from the start points are then
+ *       found without the chains having to walk to them. The evaluations
+ *       count towards `maxEvaluations`. Not set by default.
+ *     - registryFile: Path of a file shared by searches running at once in
+ *       several processes, on one host or on hosts sharing a file system with
+ *       working `flock` locks. Each pattern is sampled by the first search
+ *       that claims it in the file, and skipped by the others, so the searches
+ *       split the regions between them. Each search identifies its claims by
+ *       a token made from its host, its process and a random value, which is
+ *       kept in its checkpoint so that a resumed search keeps its claims. A
+ *       new file should be used for each set of searches. Starting them from different points, or with
+ *       `explorationSize`, spreads the patterns among them. The result of each
+ *       can be saved with `PSP_Save_Regions` and combined in one handle with
+ *       `PSP_Load_Regions`.
+ *
+ * None of the budgets `maxEvaluations`, `maxSeconds` and `maxSampleBytes` is
+ * set by default. When one runs out, the search stops and returns
+ * `PSP_ERR_BUDGET_EXHAUSTED`. Whether stopped by a budget or by `maxPatterns`,
+ * the regions found so far are still stored as set by `result_mode`, and
+ * partitions can be built from them. The volume estimation of
+ * `accurateVolEst` is then skipped.
  */
 int PSP_Get_Regions(PSP_Handle handle,
                     PSP_Sampling_Callback sampling_callback,
@@ -82,10 +241,80 @@ int PSP_Get_Regions(PSP_Handle handle,
                     PSP_Options options,
                     PSP_Result_Mode result_mode);
 
+/**
+ * Discovers parameter regions as `PSP_Get_Regions`, with the points given in
+ * double precision instead of 16.16 fixed point. The model is called through
+ * `sampler_double` or `batch_sampler_double`, which get the points straight
+ * from the storage of the sampler, without conversion or loss of precision.
+ * The regions found, and the partitions built from them, are in the same
+ * coordinates as the points. If the handle has a cache, it is emptied when
+ * switching between fixed point and double precision searches.
+ */
+int PSP_Get_Regions_Double(PSP_Handle handle,
+                           PSP_Sampling_Callback sampling_callback,
+                           int num_start_points,
+                           double const* start_points,
+                           double const* min_coords,
+                           double const* max_coords,
+                           PSP_Options options,
+                           PSP_Result_Mode result_mode);
+
+/**
+ * Continues a search started by `PSP_Get_Regions` with the `checkpointFile`
+ * option, from the last checkpoint completely written to `checkpoint_file`.
+ * The search goes on with the start points, bounds and options it was started
+ * with, and gives the same results as if it had never been interrupted. Must
+ * be called with a handle and a sampling callback of the same dimension, and
+ * keeps checkpointing to the same file. A search started by
+ * `PSP_Get_Regions_Double` must be resumed with `sampler_double` or
+ * `batch_sampler_double` set, and any other with neither set. Returns EIO if
+ * the file cannot be read or written.
+ */
+int PSP_Resume_Regions(PSP_Handle handle,
+                       PSP_Sampling_Callback sampling_callback,
+                       char const* checkpoint_file,
+                       PSP_Result_Mode result_mode);
+
+/**
+ * Writes the regions stored in the handle to `path`, so that they can be
+ * loaded in another process, such as the results of searches sharing a
+ * `registryFile`. Returns EIO if the file cannot be written.
+ */
+int PSP_Save_Regions(PSP_Handle handle,
+                     char const* path);
+
+/**
+ * Reads regions written by `PSP_Save_Regions` and stores them in the handle
+ * as set by `result_mode`, as if they had just been found by
+ * `PSP_Get_Regions`. Returns what the search that found them returned, or EIO
+ * if the file cannot be read.
+ */
+int PSP_Load_Regions(PSP_Handle handle,
+                     char const* path,
+                     PSP_Result_Mode result_mode);
+
+/**
+ * Enables a cache of model evaluations in front of the sampler, keyed on the
+ * exact fixed point coordinates of each point. The cache is kept by the handle
+ * and shared by all following calls to `PSP_Get_Regions`, so that repeated
+ * proposals and restarted searches do not evaluate the model twice at the same
+ * point. Once its estimated memory use reaches `max_bytes`, the oldest entries
+ * are evicted. Calling this again replaces the cache with an empty one; a
+ * `max_bytes` of 0 disables it. The cache is disabled by default.
+ */
+int PSP_Configure_Cache(PSP_Handle handle,
+                        size_t max_bytes);
+
+/** Retrieves the hit and miss counts and the current size of the cache. */
+int PSP_Get_Cache_Stats(PSP_Handle handle,
+                        PSP_Cache_Stats* stats);
+
 /**
  * Configures the next SVM instance to be run. The settings are persistent
- * between calls. If this function is not used before starting an SVM
- * optimization, the following default values will be used:
+ * between calls. `num_threads` is the number of planes trained at once for a
+ * KdSVM tree; 0 or 1 trains them one at a time. If this function is not used
+ * before starting an SVM optimization, the following default values will be
+ * used:
  *
  * struct svm_parameter
  * {
@@ -107,14 +336,18 @@ int PSP_Get_Regions(PSP_Handle handle,
  * };
  */
 int PSP_Configure_SVM(PSP_Handle handle,
-                      struct svm_parameter* params);
+                      struct svm_parameter* params,
+                      unsigned int num_threads);
 
 /**
  * Builds a partition of the space according to the sampled regions. Must be
  * called only after using `PSP_Get_Regions`.
  *
  * This method creates a binary space partitioning with SVM to estimate the
- * plane of separation between half-spaces.
+ * plane of separation between half-spaces. The planes are trained on the
+ * `num_threads` threads set by `PSP_Configure_SVM`, and the tree is the same
+ * for any number of threads. Each plane in training holds its own copy of the
+ * kernel cache, so fewer threads use less memory.
  */
 int PSP_Build_Partition_KdSVM(PSP_Handle handle,
                               PSP_KdSVMTree* tree);
@@ -0,0 +1,97 @@
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "registry.h"
+
+
+/* Holds the exclusive lock on a file for as long as it lives */
+class FileLock {
+public:
+    explicit FileLock(int fd) : fd(fd)
+    {
+        if (flock(fd, LOCK_EX) != 0)
+            throw PSP::registry_error("cannot lock registry file");
+    }
+    ~FileLock() { flock(fd, LOCK_UN); }
+
+private:
+    int fd;
+};
+
+
+PatternRegistry::PatternRegistry(char const* path, uint64_t owner)
+:
+owner(owner)
+{
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw PSP::registry_error("cannot open registry file");
+}
+
+PatternRegistry::~PatternRegistry()
+{
+    close(fd);
+}
+
+uint64_t PatternRegistry::new_owner()
+{
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+
+    std::random_device device;
+    uint64_t token = (uint64_t)device() << 32 | device();
+    token ^= std::hash<std::string>()(host);
+    token ^= (uint64_t)getpid() << 16;
+    token ^= std::chrono::steady_clock::now().time_since_epoch().count();
+    /* 0 is left for a search without a registry */
+    return token ? token : 1;
+}
+
+void PatternRegistry::refresh()
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        throw PSP::registry_error("cannot read registry file");
+
+    /* an entry cut short by a crash is dropped, and will be written over */
+    long end = st.st_size - st.st_size % sizeof(Entry);
+    if (end != st.st_size && ftruncate(fd, end) != 0)
+        throw PSP::registry_error("cannot repair registry file");
+
+    while (offset < end) {
+        Entry entry;
+        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry))
+            throw PSP::registry_error("cannot read registry file");
+        owners.emplace(entry.pattern, entry.owner);
+        offset += sizeof(entry);
+    }
+}
+
+bool PatternRegistry::claim(Pattern ptn)
+{
+    auto it = owners.find(ptn);
+    if (it != owners.end())
+        return it->second == owner;
+
+    FileLock lock(fd);
+    refresh();
+
+    it = owners.find(ptn);
+    if (it != owners.end())
+        return it->second == owner;
+
+    Entry entry{ ptn, owner };
+    if (pwrite(fd, &entry, sizeof(entry), offset) != sizeof(entry)
+        || fsync(fd) != 0)
+        throw PSP::registry_error("cannot write registry file");
+    owners.emplace(ptn, owner);
+    offset += sizeof(entry);
+
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#ifdef __cplusplus
+#include <stdint.h>
+#include <unordered_map>
+
+#include "psp_mcmc.h"
+
+
+/**
+ * A file of the data patterns found by several searches running at once, in
+ * other processes or on other hosts sharing the file system, so that each
+ * pattern is sampled by only one of them. The file holds one entry per
+ * pattern, with the search that claimed it first, and is only ever appended
+ * to while holding an exclusive lock on it.
+ */
+class PatternRegistry {
+public:
+    /** Opens or creates the registry at `path`, as the search `owner` */
+    PatternRegistry(char const* path, uint64_t owner);
+    PatternRegistry(PatternRegistry const& other) = delete;
+    PatternRegistry & operator=(PatternRegistry const& other) = delete;
+    ~PatternRegistry();
+
+    /**
+     * Makes an owner token for a new search, from the host, the process and
+     * a random value, so that searches started at the same time differ
+     */
+    static uint64_t new_owner();
+
+    /**
+     * Claims a pattern for this search, returning false if another search
+     * claimed it first. Claiming a pattern again is allowed, so that a
+     * resumed search keeps what it claimed before being interrupted.
+     */
+    bool claim(Pattern ptn);
+
+private:
+    struct Entry {
+        uint64_t pattern;
+        uint64_t owner;
+    };
+
+    /* Reads the entries appended since the last call, under the lock */
+    void refresh();
+
+    int fd;
+    uint64_t owner;
+    long offset = 0;
+    std::unordered_map<Pattern, uint64_t> owners;
+};
+
+#endif
+
+#endif
+
+/* EOF */
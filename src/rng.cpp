@@ -0,0 +1,196 @@
+#include <cmath>
+#include <utility>
+
+#include "rng.h"
+
+
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+static const double TWO_PI = 6.28318530717958647692528676655900577;
+
+static inline
+uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t & hi)
+{
+    uint64_t product = (uint64_t)a * b;
+    hi = (uint32_t)(product >> 32);
+    return (uint32_t)product;
+}
+
+static inline
+void philox4x32_10(uint32_t ctr[4], uint32_t const key[2])
+{
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+
+    for (int round = 0; round < 10; round++) {
+        uint32_t hi0, hi1;
+        uint32_t lo0 = mulhilo(PHILOX_M0, ctr[0], hi0);
+        uint32_t lo1 = mulhilo(PHILOX_M1, ctr[2], hi1);
+
+        ctr[0] = hi1 ^ ctr[1] ^ k0;
+        ctr[1] = lo1;
+        ctr[2] = hi0 ^ ctr[3] ^ k1;
+        ctr[3] = lo0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+/* Maps 64 random bits to a double in (0, 1), never returning 0 */
+static inline
+double to_unit(uint32_t hi, uint32_t lo)
+{
+    uint64_t bits = ((uint64_t)hi << 32 | lo) >> 11;
+    return (bits + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+
+RandomStream::RandomStream(uint64_t seed, uint64_t stream)
+:
+key{ (uint32_t)seed, (uint32_t)(seed >> 32) },
+stream(stream)
+{
+}
+
+void RandomStream::next_block(uint32_t out[4])
+{
+    out[0] = (uint32_t)counter;
+    out[1] = (uint32_t)(counter >> 32);
+    out[2] = (uint32_t)stream;
+    out[3] = (uint32_t)(stream >> 32);
+    philox4x32_10(out, key);
+    counter++;
+}
+
+double RandomStream::uniform()
+{
+    uint32_t block[4];
+    next_block(block);
+    return to_unit(block[0], block[1]);
+}
+
+void RandomStream::uniform(double* out, size_t n)
+{
+    for (size_t i = 0; i < n; i += 2) {
+        uint32_t block[4];
+        next_block(block);
+        out[i] = to_unit(block[0], block[1]);
+        if (i + 1 < n)
+            out[i + 1] = to_unit(block[2], block[3]);
+    }
+}
+
+void RandomStream::normal(double* out, size_t n)
+{
+    /* Box-Muller, one pair of deviates from each block */
+    for (size_t i = 0; i < n; i += 2) {
+        uint32_t block[4];
+        next_block(block);
+        double r = std::sqrt(-2 * std::log(to_unit(block[0], block[1])));
+        double theta = TWO_PI * to_unit(block[2], block[3]);
+        out[i] = r * std::cos(theta);
+        if (i + 1 < n)
+            out[i + 1] = r * std::sin(theta);
+    }
+}
+
+
+static
+std::vector<uint32_t> first_primes(size_t n)
+{
+    std::vector<uint32_t> primes;
+    for (uint32_t k = 2; primes.size() < n; k++) {
+        bool prime = true;
+        for (size_t i = 0; i < primes.size() && primes[i] * primes[i] <= k; i++) {
+            if (k % primes[i] == 0) {
+                prime = false;
+                break;
+            }
+        }
+        if (prime)
+            primes.push_back(k);
+    }
+    return primes;
+}
+
+HaltonSequence::HaltonSequence(size_t dim, RandomStream & rng)
+:
+bases(first_primes(dim)),
+numDigits(dim),
+perms(dim)
+{
+    for (size_t d = 0; d < dim; d++) {
+        uint32_t base = bases[d];
+        /*
+         * the digits past those of the index are scrambled too, so there is
+         * no last nonzero digit, and the expansion is cut at a precision of
+         * 2^-40, which keeps the points off 1 after rounding
+         */
+        numDigits[d] = (int)std::ceil(40 * std::log(2.0) / std::log((double)base));
+
+        /* Fisher-Yates */
+        std::vector<uint32_t> & perm = perms[d];
+        perm.resize(base);
+        for (uint32_t i = 0; i < base; i++)
+            perm[i] = i;
+        for (uint32_t i = base - 1; i > 0; i--) {
+            uint32_t j = (uint32_t)(rng.uniform() * (i + 1));
+            std::swap(perm[i], perm[j]);
+        }
+    }
+}
+
+void HaltonSequence::next(double* out)
+{
+    for (size_t d = 0; d < bases.size(); d++) {
+        uint32_t base = bases[d];
+        std::vector<uint32_t> const& perm = perms[d];
+        double scale = 1.0 / base;
+        double x = 0;
+        uint64_t n = index;
+        for (int k = 0; k < numDigits[d]; k++) {
+            x += perm[n % base] * scale;
+            n /= base;
+            scale /= base;
+        }
+        /* centre in the cell of the last digit, to stay off 0 and 1 */
+        out[d] = x + scale * base * 0.5;
+    }
+    index++;
+}
+
+/* Acklam's rational approximation, with a relative error below 1.2e-9 */
+double normal_quantile(double p)
+{
+    static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02,
+                                -2.759285104469687e+02, 1.383577518672690e+02,
+                                -3.066479806614716e+01, 2.506628277459239e+00 };
+    static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02,
+                                -1.556989798598866e+02, 6.680131188771972e+01,
+                                -1.328068155288572e+01 };
+    static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01,
+                                -2.400758277161838e+00, -2.549732539343734e+00,
+                                4.374664141464968e+00, 2.938163982698783e+00 };
+    static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01,
+                                2.445134137142996e+00, 3.754408661907416e+00 };
+    static const double P_LOW = 0.02425;
+
+    if (p < P_LOW) {
+        double q = std::sqrt(-2 * std::log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+               ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+    if (p > 1 - P_LOW) {
+        double q = std::sqrt(-2 * std::log(1 - p));
+        return -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+                ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+    double q = p - 0.5;
+    double r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+           (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
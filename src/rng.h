@@ -0,0 +1,75 @@
+#ifndef RNG_H
+#define RNG_H
+
+#ifdef __cplusplus
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+
+/**
+ * A counter-based random number stream, using the Philox4x32-10 generator of
+ * Salmon et al. (2011). Each block of output is a pure function of the seed,
+ * the stream number and the position in the stream, so that streams with
+ * different numbers are independent and can be used from different threads
+ * without any shared state. Draws are made in whole blocks, so the values a
+ * stream produces only depend on the sequence of calls made on it.
+ */
+class RandomStream {
+public:
+    RandomStream(uint64_t seed, uint64_t stream);
+
+    /** Draws a uniform deviate in (0, 1) */
+    double uniform();
+
+    /** Fills `out` with `n` uniform deviates in (0, 1) */
+    void uniform(double* out, size_t n);
+
+    /** Fills `out` with `n` standard normal deviates */
+    void normal(double* out, size_t n);
+
+    /** The number of blocks drawn so far, which identifies the stream state */
+    uint64_t position() const { return counter; }
+    void seek(uint64_t position) { counter = position; }
+
+private:
+    void next_block(uint32_t out[4]);
+
+    uint32_t key[2];
+    uint64_t stream;
+    uint64_t counter = 0;
+};
+
+/**
+ * A scrambled Halton sequence: the radical inverses of 0, 1, 2, ... in the
+ * first `dim` prime bases, one base per coordinate, with the digits of each
+ * coordinate relabelled by a random permutation drawn from `rng`. The points
+ * cover the unit cube more evenly than random ones, so that averages over
+ * them converge faster, while the scrambling keeps them unbiased and breaks
+ * the correlations between the coordinates of large bases.
+ */
+class HaltonSequence {
+public:
+    HaltonSequence(size_t dim, RandomStream & rng);
+
+    /** Fills `out` with the `dim` coordinates of the next point, in (0, 1) */
+    void next(double* out);
+
+    size_t dim() const { return bases.size(); }
+
+private:
+    std::vector<uint32_t> bases;
+    std::vector<int> numDigits;
+    std::vector<std::vector<uint32_t>> perms;
+    uint64_t index = 0;
+};
+
+/** The quantile function of the standard normal distribution */
+double normal_quantile(double p);
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,55 @@
+#include "simd_kernels.h"
+
+/*
+ * -O2 does not vectorize the loops below, so they ask for it themselves rather
+ * than raising the optimization level of the whole file
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#define PSP_VECTORIZE __attribute__((optimize("tree-vectorize")))
+#else
+#define PSP_VECTORIZE
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define PSP_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+
+#ifndef PSP_TARGET_CLONES
+#define PSP_TARGET_CLONES
+#endif
+
+PSP_TARGET_CLONES PSP_VECTORIZE
+void add_outer(double* __restrict a,
+               double const* __restrict x,
+               double const* __restrict y,
+               size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        double yj = y[j];
+        double* __restrict col = a + j * n;
+        for (size_t i = 0; i < n; i++) {
+            col[i] += x[i] * yj;
+        }
+    }
+}
+
+PSP_TARGET_CLONES PSP_VECTORIZE
+void mul_add(double* __restrict y,
+             double const* __restrict a,
+             double const* __restrict x,
+             double const* __restrict b,
+             size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        y[i] = b[i];
+    }
+    for (size_t j = 0; j < n; j++) {
+        double xj = x[j];
+        double const* __restrict col = a + j * n;
+        for (size_t i = 0; i < n; i++) {
+            y[i] += col[i] * xj;
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#ifdef __cplusplus
+#include <stddef.h>
+
+
+/*
+ * Kernels on raw column-major buffers for the dynamic-dimension hot paths of
+ * the sampler. On x86-64 they are compiled for both the baseline (SSE2) and
+ * AVX2, and the variant matching the CPU is picked when the library is
+ * loaded. Elsewhere the baseline version is used. These are the only paths
+ * chosen at run time; Eigen code, such as that of the fixed dimensions, is
+ * vectorized for the -m flags the library is built with.
+ */
+
+/** a += x * y^T, where `a` is n x n */
+void add_outer(double* a, double const* x, double const* y, size_t n);
+
+/** y = b + a * x, where `a` is n x n */
+void mul_add(double* y, double const* a, double const* x, double const* b, size_t n);
+
+#endif
+
+#endif
+
+/* EOF */
@@ -0,0 +1,107 @@
+#include "thread_pool.h"
+
+
+ThreadPool::ThreadPool(size_t num_threads)
+{
+    for (size_t i = 1; i < num_threads; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t n, Thunk thunk, void const* fn)
+{
+    if (n == 0)
+        return;
+
+    if (workers.empty() || n == 1) {
+        for (size_t i = 0; i < n; i++) {
+            thunk(fn, i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_thunk = thunk;
+        job = fn;
+        job_size = n;
+        next_item = 0;
+        pending = n;
+        error = nullptr;
+        generation++;
+    }
+    work_ready.notify_all();
+
+    run_items();
+
+    std::exception_ptr err;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+        err = error;
+        error = nullptr;
+    }
+
+    if (err)
+        std::rethrow_exception(err);
+}
+
+void ThreadPool::worker_loop()
+{
+    unsigned long seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        run_items();
+    }
+}
+
+void ThreadPool::run_items()
+{
+    while (true) {
+        Thunk thunk;
+        void const* fn;
+        size_t i;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job || next_item >= job_size)
+                return;
+            thunk = job_thunk;
+            fn = job;
+            i = next_item++;
+        }
+
+        try {
+            thunk(fn, i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            work_done.notify_all();
+    }
+}
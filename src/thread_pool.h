@@ -0,0 +1,65 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#ifdef __cplusplus
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * A fixed set of worker threads used to spread independent work items, such
+ * as model evaluations, across cores. The calling thread always takes part in
+ * the work, so a pool of size 1 runs everything inline without spawning any
+ * threads.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t num_threads);
+    ThreadPool(ThreadPool const& other) = delete;
+    ThreadPool & operator=(ThreadPool const& other) = delete;
+    ~ThreadPool();
+
+    size_t size() const { return workers.size() + 1; }
+
+    /**
+     * Calls `fn(i)` for every i in [0, n) and blocks until all calls have
+     * returned. The first exception thrown by any call is rethrown here.
+     * `fn` is called through a plain function pointer rather than wrapped in
+     * a std::function, so that starting the work allocates no memory.
+     */
+    template <typename Fn>
+    void parallel_for(size_t n, Fn const& fn)
+    {
+        run(n, [](void const* fn, size_t i) { (*static_cast<Fn const*>(fn))(i); }, &fn);
+    }
+
+private:
+    using Thunk = void (*)(void const* fn, size_t i);
+
+    void run(size_t n, Thunk thunk, void const* fn);
+    void worker_loop();
+    void run_items();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    Thunk job_thunk = nullptr;
+    void const* job = nullptr;
+    size_t job_size = 0;
+    size_t next_item = 0;
+    size_t pending = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};
+
+#endif
+
+#endif
+
+/* EOF */
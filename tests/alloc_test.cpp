@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <pspart.h>
+
+/*
+ * Counts the calls to operator new made while the Markov chains sample after
+ * adaptation, which should not allocate per evaluation, for a fixed and a
+ * dynamic point dimension, serially, on two threads and with a batch sampler.
+ */
+
+static std::atomic<size_t> numAllocs(0);
+
+void* operator new(size_t size)
+{
+    numAllocs++;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+struct Context {
+    size_t dim;
+    /* allocations and evaluations at the first and last report after adaptation */
+    bool started;
+    size_t allocs;
+    unsigned long evaluations;
+    size_t lastAllocs;
+    unsigned long lastEvaluations;
+};
+
+static size_t sampler(void*, Fixed* point)
+{
+    return point[0] < 0 ? 1 : 2;
+}
+
+static void batch_sampler(void* sampling_context, size_t n, Fixed* points, size_t* patterns)
+{
+    Context* ctx = (Context*)sampling_context;
+    for (size_t i = 0; i < n; i++) {
+        patterns[i] = sampler(ctx, points + i * ctx->dim);
+    }
+}
+
+static int progress(void* sampling_context, PSP_Progress const* report)
+{
+    size_t allocs = numAllocs;
+    Context* ctx = (Context*)sampling_context;
+
+    bool adapted = report->numRegions == 2;
+    for (size_t i = 0; i < report->numRegions; i++) {
+        adapted = adapted && report->regions[i].level == 2;
+    }
+    if (!adapted)
+        return 0;
+
+    if (!ctx->started) {
+        ctx->started = true;
+        ctx->allocs = allocs;
+        ctx->evaluations = report->evaluations;
+    }
+    ctx->lastAllocs = allocs;
+    ctx->lastEvaluations = report->evaluations;
+    return 0;
+}
+
+static bool run(size_t dim, unsigned int numThreads, bool batch)
+{
+    Context ctx = {};
+    ctx.dim = dim;
+
+    PSP_Handle hn = PSP_New(dim);
+    PSP_Sampling_CallbackRec cb = {};
+    cb.sampling_context = &ctx;
+    cb.sampler = batch ? NULL : sampler;
+    cb.batch_sampler = batch ? batch_sampler : NULL;
+    cb.progress = progress;
+
+    Fixed* x0 = (Fixed*)calloc(2 * dim, sizeof(Fixed));
+    Fixed* xm = (Fixed*)calloc(dim, sizeof(Fixed));
+    Fixed* xM = (Fixed*)calloc(dim, sizeof(Fixed));
+    for (size_t d = 0; d < dim; d++) {
+        xm[d] = -65536;
+        xM[d] = 65536;
+    }
+    x0[0] = -32768;
+    x0[dim] = 32768;
+
+    PSP_Options options = {};
+    options.smpSz1 = 50;
+    options.smpSz2 = 100;
+    options.seed = 1;
+    options.maxPatterns = 10;
+    options.numThreads = numThreads;
+    options.retention = PSP_RETAIN_NONE;
+    options.progressInterval = 1e-9;
+
+    int ret = PSP_Get_Regions(hn, &cb, 2, x0, xm, xM, options, PSP_RESULT_OVERWRITE);
+    PSP_Close(hn);
+    free(x0);
+    free(xm);
+    free(xM);
+
+    unsigned long evaluations = ctx.lastEvaluations - ctx.evaluations;
+    double perEvaluation = evaluations ? (double)(ctx.lastAllocs - ctx.allocs) / evaluations : 0;
+    printf("dim %zu, %u threads%s: %g allocations per evaluation over %lu evaluations\n",
+           dim, numThreads, batch ? ", batch" : "", perEvaluation, evaluations);
+
+    if (ret != 0 || evaluations < 100) {
+        fprintf(stderr, "search returned %d after %lu adapted evaluations\n", ret, evaluations);
+        return false;
+    }
+    return perEvaluation < 0.01;
+}
+
+int main()
+{
+    bool ok = true;
+    for (size_t dim : { 2, 10 }) {
+        ok = run(dim, 0, false) && ok;
+        ok = run(dim, 2, false) && ok;
+        ok = run(dim, 0, true) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <pspart.h>
+
+/*
+ * Every proposal of a model with a single pattern and reflecting bounds is
+ * accepted, so the chain keeps widening its jumps and stays in the first
+ * adaptation level, and the acceptance rate of each cycle is 1.
+ */
+
+#define SMP_SZ1 20
+
+struct Context {
+    int reports;
+    int laterCycleReports;
+    int failures;
+};
+
+static size_t sampler(void*, Fixed*)
+{
+    return 1;
+}
+
+static int progress(void* sampling_context, PSP_Progress const* report)
+{
+    Context* ctx = (Context*)sampling_context;
+    ctx->reports++;
+
+    if (report->numRegions != 1 || report->regions[0].level != 0) {
+        fprintf(stderr, "unexpected regions after %lu trials\n", report->trials);
+        ctx->failures++;
+        return 0;
+    }
+
+    double rate = report->regions[0].acceptanceRate;
+    /* 0 right after a cycle has ended, when the next has no samples yet */
+    bool cycleStart = report->trials % SMP_SZ1 == 0;
+    if (rate != (cycleStart ? 0 : 1)) {
+        fprintf(stderr, "acceptance rate %g after %lu trials\n", rate, report->trials);
+        ctx->failures++;
+    }
+    if (report->trials > SMP_SZ1 && !cycleStart) {
+        ctx->laterCycleReports++;
+    }
+    return 0;
+}
+
+int main()
+{
+    Context ctx = {};
+    PSP_Handle hn = PSP_New(2);
+    PSP_Sampling_CallbackRec cb = {};
+    cb.sampling_context = &ctx;
+    cb.sampler = sampler;
+    cb.progress = progress;
+
+    Fixed x0[2] = { 0, 0 };
+    Fixed xm[2] = { -65536, -65536 };
+    Fixed xM[2] = { 65536, 65536 };
+    PSP_Options options = {};
+    options.smpSz1 = SMP_SZ1;
+    options.seed = 1;
+    options.maxPatterns = 10;
+    options.boundary = PSP_BOUNDARY_REFLECT;
+    options.maxEvaluations = 5 * SMP_SZ1 + 1;
+    options.progressInterval = 1e-9;
+
+    int ret = PSP_Get_Regions(hn, &cb, 1, x0, xm, xM, options, PSP_RESULT_OVERWRITE);
+    PSP_Close(hn);
+
+    if (ret != PSP_ERR_BUDGET_EXHAUSTED) {
+        fprintf(stderr, "search returned %d\n", ret);
+        return 1;
+    }
+    if (ctx.laterCycleReports == 0) {
+        fprintf(stderr, "no reports after the first cycle (%d reports)\n", ctx.reports);
+        return 1;
+    }
+    return ctx.failures == 0 ? 0 : 1;
+}